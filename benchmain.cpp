@@ -0,0 +1,517 @@
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHeaderView>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QTableView>
+#include <algorithm>
+#include <cstdio>
+#include "codepage.h"
+#include "codepointindex.h"
+#include "directorysnapshot.h"
+#include "preflight.h"
+#include "renameplan.h"
+#include "task.h"
+#include "taskmodel.h"
+#include "unicodeform.h"
+
+// Times the rename engine on synthetic file sets and prints one JSON
+// object per measurement, so that runs of different builds can be diffed
+// or loaded into a spreadsheet. Only real renames and the preflight touch
+// the disk; their files are created under --dir, which should be on tmpfs
+// to keep the disk itself out of the numbers.
+
+struct RuleCase
+{
+    const char* name;
+    Task::Rule rule;
+    QList<QString> strings;
+    QList<int> numbers;
+};
+
+static const qsizetype filesPerDir = 1000;
+
+static QList<RuleCase> ruleCases()
+{
+    return QList<RuleCase>()
+        << RuleCase{"Rename", Task::Rename, {"bench"}, {}}
+        << RuleCase{"OrdinalWithPrefix", Task::OrdinalWithPrefix, {"f", "0001"}, {}}
+        << RuleCase{"OrdinalWithPrefixReverse", Task::OrdinalWithPrefixReverse, {"f", "9999"}, {}}
+        << RuleCase{"OrdinalByName", Task::OrdinalWithPrefix, {"f", "0001"}, {RenamePlan::ByName}}
+        << RuleCase{"Replace", Task::Replace, {"1", "一"}, {}}
+        << RuleCase{"Insert", Task::Insert, {"新"}, {2}}
+        << RuleCase{"InsertLast", Task::InsertLast, {"新"}, {2}}
+        << RuleCase{"Delete", Task::Delete, {}, {1, 2}}
+        << RuleCase{"DeleteLast", Task::DeleteLast, {}, {1, 2}}
+        << RuleCase{"ToUnicode", Task::ToUnicode, {"Shift-JIS"}, {}}
+        << RuleCase{"ToLocale", Task::ToLocale, {"Big5"}, {}}
+        << RuleCase{"Template", Task::Template, {"{parent}_{name}_{n:04}{ext}"}, {}}
+        << RuleCase{"NormalizeNFC", Task::Normalize, {}, {QString::NormalizationForm_C}}
+        << RuleCase{"ChangeCaseTitle", Task::ChangeCase, {}, {UnicodeForm::TitleCase}};
+}
+
+static QString randomName(const QString& kind, qsizetype index, QRandomGenerator& random)
+{
+    static const char ascii[] = "abcdefghijklmnopqrstuvwxyz0123456789_-";
+    static const char* const suffixes[] = {"txt", "jpg", "mp3", "tar.gz", "cpp"};
+    QString name;
+    if (kind == "ascii")
+    {
+        int length = random.bounded(8, 25);
+        for (int i = 0; i < length; ++i)
+            name += QChar(ascii[random.bounded(int(sizeof(ascii) - 1))]);
+    }
+    else if (kind == "cjk")
+    {
+        int length = random.bounded(4, 13);
+        for (int i = 0; i < length; ++i)
+            name += QChar(char16_t(random.bounded(0x4e00, 0xa000)));
+    }
+    else if (kind == "accented")
+    {
+        // Latin letters, a third of them accented, half of those written
+        // precomposed and half decomposed, the way macOS stores them.
+        static const char16_t marks[] = {0x0300, 0x0301, 0x0302, 0x0308, 0x030a};
+        int length = random.bounded(8, 25);
+        for (int i = 0; i < length; ++i)
+        {
+            QString letter(QChar(ascii[random.bounded(26)]));
+            if (random.bounded(3) == 0)
+            {
+                letter += QChar(marks[random.bounded(int(sizeof(marks) / sizeof(*marks)))]);
+                if (random.bounded(2))
+                    letter = letter.normalized(QString::NormalizationForm_C);
+            }
+            name += letter;
+        }
+    }
+    else
+    {
+        // Anything from one to eighty code points, with ASCII, CJK and
+        // characters outside the BMP in the same name.
+        int length = random.bounded(1, 81);
+        for (int i = 0; i < length; ++i)
+        {
+            switch (random.bounded(3))
+            {
+                case 0:
+                    name += QChar(ascii[random.bounded(int(sizeof(ascii) - 1))]);
+                break;
+                case 1:
+                    name += QChar(char16_t(random.bounded(0x4e00, 0xa000)));
+                break;
+                default:
+                {
+                    char32_t ucs4 = char32_t(random.bounded(0x1f300, 0x1f600));
+                    name += QString::fromUcs4(&ucs4, 1);
+                }
+                break;
+            }
+        }
+    }
+    // The index keeps every name unique within its directory.
+    return name + QString("-%1.").arg(index) + suffixes[random.bounded(int(sizeof(suffixes) / sizeof(*suffixes)))];
+}
+
+static QStringList makePaths(const QString& root, const QString& kind, qsizetype count)
+{
+    QRandomGenerator random(quint32(count) ^ qHash(kind));
+    QStringList paths;
+    paths.reserve(count);
+    for (qsizetype i = 0; i < count; ++i)
+        paths.append(QString("%1/d%2/%3").arg(root).arg(i / filesPerDir).arg(randomName(kind, i, random)));
+    return paths;
+}
+
+static Task makeTask(const QStringList& paths)
+{
+    Task task;
+    foreach (const auto& path, paths)
+        task.append(path);
+    return task;
+}
+
+static bool createFiles(const QString& root, const QStringList& paths)
+{
+    for (qsizetype i = 0; i < paths.size(); i += filesPerDir)
+        if (!QDir().mkpath(QString("%1/d%2").arg(root).arg(i / filesPerDir)))
+            return false;
+    foreach (const auto& path, paths)
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly))
+            return false;
+    }
+    return true;
+}
+
+static void report(QJsonObject result, qsizetype count, const QList<double>& seconds)
+{
+    QList<double> sorted = seconds;
+    std::sort(sorted.begin(), sorted.end());
+    double best = sorted.first();
+    result.insert("count", double(count));
+    result.insert("repeat", int(sorted.size()));
+    result.insert("best", best);
+    result.insert("median", sorted.at(sorted.size() / 2));
+    result.insert("itemsPerSecond", best > 0 ? count / best : 0.0);
+    QByteArray line = QJsonDocument(result).toJson(QJsonDocument::Compact);
+    fprintf(stdout, "%s\n", line.constData());
+    fflush(stdout);
+}
+
+static double elapsedSeconds(const QElapsedTimer& timer)
+{
+    return timer.nsecsElapsed() / 1e9;
+}
+
+static void benchPreview(const QString& kind, const QStringList& paths, int repeat)
+{
+    Task task = makeTask(paths);
+    foreach (const auto& rc, ruleCases())
+    {
+        RenamePlan plan(Task::ExtExcluded, rc.rule, rc.strings, rc.numbers);
+        if (!plan.isValid())
+        {
+            qWarning() << "Skipping " << rc.name << ": " << plan.errorString();
+            continue;
+        }
+        QList<double> seconds;
+        for (int r = 0; r < repeat; ++r)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            task.renameTestAll(plan);
+            seconds.append(elapsedSeconds(timer));
+        }
+        QJsonObject result;
+        result.insert("benchmark", "preview");
+        result.insert("rule", rc.name);
+        result.insert("names", kind);
+        report(result, paths.size(), seconds);
+    }
+}
+
+static void benchDetect(const QString& kind, const QStringList& paths, int repeat)
+{
+    Task task = makeTask(paths);
+    QList<double> seconds;
+    QString codePage;
+    for (int r = 0; r < repeat; ++r)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        codePage = CodePage::detect(task, Task::ToUnicode);
+        seconds.append(elapsedSeconds(timer));
+    }
+    QJsonObject result;
+    result.insert("benchmark", "detectCodePage");
+    result.insert("names", kind);
+    result.insert("codePage", codePage);
+    report(result, paths.size(), seconds);
+}
+
+static void benchSeek(const QString& kind, const QStringList& paths, int repeat)
+{
+    QList<QByteArray> names;
+    names.reserve(paths.size());
+    foreach (const auto& path, paths)
+        names.append(QFileInfo(path).fileName().toUtf8());
+    QList<double> seconds;
+    qsizetype sink = 0;
+    for (int r = 0; r < repeat; ++r)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        for (auto& name : names)
+        {
+            sink += Task::indexofUtf8(name, 0, 3);
+            sink += Task::indexofUtf8(name, name.size(), -3);
+        }
+        seconds.append(elapsedSeconds(timer));
+    }
+    QJsonObject result;
+    result.insert("benchmark", "indexofUtf8");
+    result.insert("names", kind);
+    result.insert("checksum", double(sink));
+    report(result, paths.size(), seconds);
+}
+
+static void benchReplace(const QString& kind, const QStringList& paths, int repeat)
+{
+    // Each Replace variant against what it replaces: one QString::replace
+    // per name, with a regular expression built per name where the old
+    // code would have needed one. Both sides run on one thread, so only
+    // the kernels are compared.
+    struct ReplaceCase
+    {
+        const char* name;
+        QString from;
+        QString to;
+        int flags;
+    };
+    QList<ReplaceCase> cases = QList<ReplaceCase>()
+        << ReplaceCase{"short", "a", "b", 0}
+        << ReplaceCase{"long", "abc-1", "x", 0}
+        << ReplaceCase{"caseInsensitive", "ABC-1", "x", RenamePlan::CaseInsensitive}
+        << ReplaceCase{"regex", "([a-z]+)-([0-9]+)", "\\2_\\1", RenamePlan::RegularExpression};
+    QList<QString> names;
+    names.reserve(paths.size());
+    foreach (const auto& path, paths)
+        names.append(QFileInfo(path).completeBaseName());
+    foreach (const auto& rc, cases)
+    {
+        RenamePlan plan(Task::ExtExcluded, Task::Replace, {rc.from, rc.to}, {rc.flags});
+        Qt::CaseSensitivity cs = rc.flags & RenamePlan::CaseInsensitive ? Qt::CaseInsensitive : Qt::CaseSensitive;
+        QList<double> baseline;
+        QList<double> seconds;
+        qsizetype sink = 0;
+        for (int r = 0; r < repeat; ++r)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            foreach (const auto& name, names)
+            {
+                QString modText = name;
+                if (rc.flags & RenamePlan::RegularExpression)
+                    modText.replace(QRegularExpression(rc.from), rc.to);
+                else
+                    modText.replace(rc.from, rc.to, cs);
+                sink += modText.size();
+            }
+            baseline.append(elapsedSeconds(timer));
+            QString modFileName;
+            timer.start();
+            for (qsizetype i = 0; i < names.size(); ++i)
+            {
+                plan.apply(names.at(i), i, modFileName);
+                sink += modFileName.size();
+            }
+            seconds.append(elapsedSeconds(timer));
+        }
+        QJsonObject result;
+        result.insert("names", kind);
+        result.insert("pattern", rc.name);
+        result.insert("checksum", double(sink));
+        result.insert("benchmark", "replaceBaseline");
+        report(result, paths.size(), baseline);
+        result.insert("benchmark", "replace");
+        report(result, paths.size(), seconds);
+    }
+}
+
+static void benchNormalize(const QString& kind, const QStringList& paths, int repeat)
+{
+    // UnicodeForm against the QString calls it stands in for, on one
+    // thread; every name must come out the same both ways.
+    struct FormCase
+    {
+        const char* name;
+        int form;
+        int letterCase;
+    };
+    QList<FormCase> cases = QList<FormCase>()
+        << FormCase{"NFC", QString::NormalizationForm_C, -1}
+        << FormCase{"NFD", QString::NormalizationForm_D, -1}
+        << FormCase{"NFKC", QString::NormalizationForm_KC, -1}
+        << FormCase{"upper", -1, UnicodeForm::UpperCase}
+        << FormCase{"lower", -1, UnicodeForm::LowerCase};
+    QList<QString> names;
+    names.reserve(paths.size());
+    foreach (const auto& path, paths)
+        names.append(QFileInfo(path).fileName());
+    foreach (const auto& fc, cases)
+    {
+        QList<double> baseline;
+        QList<double> seconds;
+        QList<QString> expected(names.size());
+        qsizetype mismatches = 0;
+        for (int r = 0; r < repeat; ++r)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            for (qsizetype i = 0; i < names.size(); ++i)
+            {
+                if (fc.form >= 0)
+                    expected[i] = names.at(i).normalized(QString::NormalizationForm(fc.form));
+                else if (fc.letterCase == UnicodeForm::UpperCase)
+                    expected[i] = names.at(i).toUpper();
+                else
+                    expected[i] = names.at(i).toLower();
+            }
+            baseline.append(elapsedSeconds(timer));
+            mismatches = 0;
+            QString modText;
+            timer.start();
+            for (qsizetype i = 0; i < names.size(); ++i)
+            {
+                // The kernels work on a buffer of their own, as in a plan.
+                modText.resize(0);
+                modText += names.at(i);
+                if (fc.form >= 0)
+                    UnicodeForm::normalize(modText, QString::NormalizationForm(fc.form));
+                else
+                    UnicodeForm::changeCase(modText, UnicodeForm::Case(fc.letterCase));
+                mismatches += modText != expected.at(i);
+            }
+            seconds.append(elapsedSeconds(timer));
+        }
+        QJsonObject result;
+        result.insert("names", kind);
+        result.insert("form", fc.name);
+        result.insert("mismatches", double(mismatches));
+        result.insert("benchmark", "normalizeBaseline");
+        report(result, paths.size(), baseline);
+        result.insert("benchmark", "normalize");
+        report(result, paths.size(), seconds);
+    }
+}
+
+static void benchRename(const QString& kind, const QString& root, const QStringList& paths, int repeat)
+{
+    // Every round works on a fresh tree, so it renames the same files.
+    RenamePlan plan(Task::ExtExcluded, Task::Insert, {"r"}, {0});
+    QList<double> seconds;
+    for (int r = 0; r < repeat; ++r)
+    {
+        QDir(root).removeRecursively();
+        if (!createFiles(root, paths))
+        {
+            qWarning() << "Cannot create files under " << root;
+            return;
+        }
+        Task task = makeTask(paths);
+        QElapsedTimer timer;
+        timer.start();
+        task.renameAll(plan);
+        seconds.append(elapsedSeconds(timer));
+    }
+    QDir(root).removeRecursively();
+    QJsonObject result;
+    result.insert("benchmark", "renameAll");
+    result.insert("names", kind);
+    report(result, paths.size(), seconds);
+}
+
+static void benchPreflight(const QString& kind, const QString& root, const QStringList& paths, int repeat)
+{
+    // A cold check reads every directory, as a run does; a warm one finds
+    // them in the snapshot, as every preview after the first does. Every
+    // item is given the same new name, so all but one per directory
+    // collide and are numbered.
+    QDir(root).removeRecursively();
+    if (!createFiles(root, paths))
+    {
+        qWarning() << "Cannot create files under " << root;
+        return;
+    }
+    Task task = makeTask(paths);
+    QList<QString> names(task.size(), QString("bench.txt"));
+    DirectorySnapshot warm;
+    Preflight::check(task, names, Task::ReportCollisions, warm);
+    for (int cold = 0; cold < 2; ++cold)
+    {
+        QList<double> seconds;
+        for (int r = 0; r < repeat; ++r)
+        {
+            DirectorySnapshot snapshot;
+            QList<QString> resolved = names;
+            QElapsedTimer timer;
+            timer.start();
+            Preflight::check(task, resolved, Task::SuffixCollisions, cold ? snapshot : warm);
+            seconds.append(elapsedSeconds(timer));
+        }
+        QJsonObject result;
+        result.insert("benchmark", "preflight");
+        result.insert("snapshot", cold ? "cold" : "warm");
+        result.insert("names", kind);
+        report(result, paths.size(), seconds);
+    }
+    QDir(root).removeRecursively();
+}
+
+static void benchView(const QString& kind, const QStringList& paths, int repeat)
+{
+    // What MainWindow::setTaskView costs: handing the task to the model
+    // and painting the visible part of the table, at the top and halfway.
+    Task task = makeTask(paths);
+    task.renameTestAll(RenamePlan(Task::ExtExcluded, Task::Insert, {"r"}, {0}));
+    TaskModel model;
+    QTableView view;
+    view.resize(367, 115);
+    view.verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    view.horizontalHeader()->setStretchLastSection(true);
+    view.setModel(&model);
+    QList<double> seconds;
+    for (int r = 0; r < repeat; ++r)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        model.setTask(nullptr);
+        model.setTask(&task);
+        view.grab();
+        view.scrollTo(model.index(int(task.size() / 2), 0));
+        view.grab();
+        seconds.append(elapsedSeconds(timer));
+    }
+    QJsonObject result;
+    result.insert("benchmark", "setTaskView");
+    result.insert("names", kind);
+    report(result, paths.size(), seconds);
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times previews, code page detection, code-point seeking, normalization, renames, the preflight and the task view on synthetic file sets; prints one JSON object per line.");
+    parser.addHelpOption();
+    QString defaultDir = QDir("/dev/shm").exists() ? "/dev/shm" : QDir::tempPath();
+    QCommandLineOption sizesOption("sizes", "Comma-separated set sizes.", "list", "10000,100000,1000000");
+    QCommandLineOption kindsOption("kinds", "Comma-separated name kinds: ascii, cjk, accented, mixed.", "list", "ascii,cjk,accented,mixed");
+    QCommandLineOption repeatOption("repeat", "Rounds per measurement.", "count", "3");
+    QCommandLineOption dirOption("dir", "Where files are created for real renames.", "path", defaultDir);
+    QCommandLineOption noRenameOption("no-rename", "Skip real renames and the preflight.");
+    QCommandLineOption noViewOption("no-view", "Skip view rendering.");
+    parser.addOption(sizesOption);
+    parser.addOption(kindsOption);
+    parser.addOption(repeatOption);
+    parser.addOption(dirOption);
+    parser.addOption(noRenameOption);
+    parser.addOption(noViewOption);
+    parser.process(app);
+
+    int repeat = qMax(parser.value(repeatOption).toInt(), 1);
+    QString root = QDir(parser.value(dirOption)).filePath(QString("koi-renamer-bench-%1").arg(QCoreApplication::applicationPid()));
+    foreach (const auto& size, parser.value(sizesOption).split(QChar(','), Qt::SkipEmptyParts))
+    {
+        qsizetype count = size.toLongLong();
+        if (count <= 0)
+            continue;
+        foreach (const auto& kind, parser.value(kindsOption).split(QChar(','), Qt::SkipEmptyParts))
+        {
+            QStringList paths = makePaths(root, kind, count);
+            benchPreview(kind, paths, repeat);
+            benchDetect(kind, paths, repeat);
+            benchSeek(kind, paths, repeat);
+            benchReplace(kind, paths, repeat);
+            benchNormalize(kind, paths, repeat);
+            if (!parser.isSet(noRenameOption))
+            {
+                benchRename(kind, root, paths, repeat);
+                benchPreflight(kind, root, paths, repeat);
+            }
+            if (!parser.isSet(noViewOption))
+                benchView(kind, paths, repeat);
+        }
+    }
+    return 0;
+}
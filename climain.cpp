@@ -0,0 +1,387 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <cstdio>
+#include <cstring>
+#include "codepage.h"
+#include "renamejournal.h"
+#include "renameplan.h"
+#include "task.h"
+#include "taskfile.h"
+#include "trace.h"
+
+#ifdef Q_OS_WIN
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Headless front end of the Task engine. Paths come in NUL-delimited,
+// either from stdin or from a file, and every item that gets a new name
+// goes out as "old\0new\0", after a preview or after the real renames.
+// A preview can also be saved as a plan and applied by a later run. New
+// names that collide are counted on stderr, or numbered on request.
+
+static const struct
+{
+    const char* name;
+    Task::Rule rule;
+} ruleNames[] = {
+    {"rename", Task::Rename},
+    {"ordinal", Task::OrdinalWithPrefix},
+    {"ordinal-reverse", Task::OrdinalWithPrefixReverse},
+    {"replace", Task::Replace},
+    {"insert", Task::Insert},
+    {"insert-last", Task::InsertLast},
+    {"delete", Task::Delete},
+    {"delete-last", Task::DeleteLast},
+    {"to-unicode", Task::ToUnicode},
+    {"to-locale", Task::ToLocale},
+    {"template", Task::Template},
+    {"normalize", Task::Normalize},
+    {"case", Task::ChangeCase},
+};
+
+// Same order as RenamePlan::Order, QString::NormalizationForm and
+// UnicodeForm::Case.
+static const char* const orderNames[] = {"drop", "name", "modified", "size", "created"};
+static const char* const formNames[] = {"nfd", "nfc", "nfkd", "nfkc"};
+static const char* const caseNames[] = {"upper", "lower", "title"};
+
+static QString tr(const char* text)
+{
+    return QCoreApplication::translate("KoiRenamerCli", text);
+}
+
+static bool readPaths(FILE* input, Task& task)
+{
+    // Input is read in large blocks and split in place; a path may span
+    // two blocks, and the last one does not need a terminating NUL.
+    Trace::Span span("readPaths");
+    QByteArray block(1 << 20, Qt::Uninitialized);
+    QByteArray pending;
+    size_t size;
+    while ((size = fread(block.data(), 1, block.size(), input)) > 0)
+    {
+        const char* begin = block.constData();
+        const char* end = begin + size;
+        for (const char* nul; (nul = static_cast<const char*>(memchr(begin, '\0', end - begin))); begin = nul + 1)
+        {
+            if (pending.isEmpty())
+            {
+                if (nul != begin)
+                    task.append(QFile::decodeName(QByteArray(begin, nul - begin)));
+            }
+            else
+            {
+                pending.append(begin, nul - begin);
+                task.append(QFile::decodeName(pending));
+                pending.clear();
+            }
+        }
+        pending.append(begin, end - begin);
+    }
+    if (!pending.isEmpty())
+        task.append(QFile::decodeName(pending));
+    return !ferror(input);
+}
+
+static void writePair(FILE* output, const QString& from, const QString& to)
+{
+    QByteArray fromName = QFile::encodeName(from);
+    QByteArray toName = QFile::encodeName(to);
+    fwrite(fromName.constData(), 1, fromName.size() + 1, output);
+    fwrite(toName.constData(), 1, toName.size() + 1, output);
+}
+
+static void writeRenamed(FILE* output, const Task& task)
+{
+    for (const auto& entry : task)
+    {
+        qsizetype depth = entry.depth();
+        if (depth > 1)
+            writePair(output, entry.filePath(0), entry.filePath(depth - 1));
+    }
+    fflush(output);
+}
+
+static void reportCollisions(const QList<qsizetype>& collisions, Task::Resolution resolution)
+{
+    if (collisions.isEmpty())
+        return;
+    if (resolution == Task::SuffixCollisions)
+        fprintf(stderr, "%s\n", qPrintable(tr("%1 個新檔名已被占用，改加上編號。").arg(collisions.size())));
+    else
+        fprintf(stderr, "%s\n", qPrintable(tr("%1 個新檔名與現有項目或彼此撞名。").arg(collisions.size())));
+}
+
+static int reportRename(const Task& task, qsizetype failed)
+{
+    writeRenamed(stdout, task);
+    Trace::summarize("rename");
+    if (failed)
+    {
+        fprintf(stderr, "%s\n", qPrintable(tr("%1 個項目改名失敗。").arg(failed)));
+        return 2;
+    }
+    return 0;
+}
+
+// Lists, or carries out, the renames of a plan saved by --save-plan; the
+// rules that computed it are not needed any more.
+static int runPlan(const QString& fileName, bool apply, bool journaled)
+{
+    Task task;
+    TaskFile file(fileName);
+    if (!file.read(task))
+    {
+        fprintf(stderr, "%s\n", qPrintable(file.errorString()));
+        return 1;
+    }
+    if (file.format() != TaskFile::Plan)
+    {
+        fprintf(stderr, "%s\n", qPrintable(tr("%1 不是改名計畫。").arg(fileName)));
+        return 1;
+    }
+    if (!apply)
+    {
+        writeRenamed(stdout, task);
+        return 0;
+    }
+    if (task.getStatus() != Task::Tested)
+    {
+        fprintf(stderr, "%s\n", qPrintable(tr("%1 沒有待執行的改名。").arg(fileName)));
+        return 1;
+    }
+    qsizetype failed = 0;
+    Task::Progress progress = [&failed](qsizetype, qsizetype failures, qsizetype) {
+        failed = failures;
+        return true;
+    };
+    RenameJournal journal;
+    if (journaled && !journal.open())
+    {
+        fprintf(stderr, "%s\n", qPrintable(tr("%1 若仍要改名，請加上 --no-journal。").arg(journal.errorString())));
+        return 1;
+    }
+    task.executeAll(progress, journaled ? &journal : nullptr);
+    return reportRename(task, failed);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    // Journals are shared with the GUI, which can undo a headless run.
+    QCoreApplication::setApplicationName("KoiRenamer");
+    QStringList rules;
+    for (const auto& r : ruleNames)
+        rules.append(r.name);
+    QCommandLineParser parser;
+    parser.setApplicationDescription(tr("從標準輸入或檔案讀入以 NUL 分隔的路徑，依規則改名，並輸出 \"舊路徑\\0新路徑\\0\"。"));
+    parser.addHelpOption();
+    QCommandLineOption ruleOption(QStringList() << "r" << "rule", tr("改名邏輯：%1").arg(rules.join(", ")), "rule");
+    QCommandLineOption stringOption(QStringList() << "s" << "string", tr("規則的文字參數，依序給定，可重複。字碼轉換的代碼頁可給 auto，依全部檔名偵測。"), "text");
+    QCommandLineOption numberOption(QStringList() << "n" << "number", tr("規則的數字參數（位置由 0 起算），依序給定，可重複。"), "number");
+    QCommandLineOption extOnlyOption("ext-only", tr("改副檔名，而非主檔名。"));
+    QCommandLineOption regexOption("regex", tr("取代：原文字為正規表示式，新文字可用 \\1、\\2 …代入。"));
+    QCommandLineOption ignoreCaseOption("ignore-case", tr("取代：不分大小寫。"));
+    QStringList orders;
+    for (const auto& o : orderNames)
+        orders.append(o);
+    QCommandLineOption orderOption("order", tr("序號與樣板的 {n}：依此排序編號，%1；預設為 drop，即輸入順序。").arg(orders.join(", ")), "order");
+    QStringList forms;
+    for (const auto& f : formNames)
+        forms.append(f);
+    QCommandLineOption formOption("form", tr("normalize：轉成哪種 Unicode 正規化形式，%1；預設為 nfc。").arg(forms.join(", ")), "form", "nfc");
+    QStringList cases;
+    for (const auto& c : caseNames)
+        cases.append(c);
+    QCommandLineOption caseOption("case", tr("case：轉成 %1；預設為 lower。").arg(cases.join(", ")), "case", "lower");
+    QCommandLineOption inputOption(QStringList() << "i" << "input", tr("路徑清單檔，預設為標準輸入。"), "file", "-");
+    QCommandLineOption applyOption("apply", tr("實際改名；未指定時只輸出測試結果。"));
+    QCommandLineOption suffixOption("suffix-collisions", tr("新檔名與現有項目或彼此撞名時，自動加上 (2)、(3) …編號。"));
+    QCommandLineOption noJournalOption("no-journal", tr("不寫入改名日誌，之後無法復原。"));
+    QCommandLineOption planOption("plan", tr("讀入 --save-plan 存下的改名計畫，不再套用規則；配合 --apply 照計畫改名。"), "file");
+    QCommandLineOption savePlanOption("save-plan", tr("把測試結果存成改名計畫，日後或在別台電腦以 --plan 套用。"), "file");
+    QCommandLineOption traceOption("trace", tr("把計時與計數寫成 Chrome trace JSON，並在結束時輸出摘要。"), "file");
+    parser.addOption(ruleOption);
+    parser.addOption(stringOption);
+    parser.addOption(numberOption);
+    parser.addOption(extOnlyOption);
+    parser.addOption(regexOption);
+    parser.addOption(ignoreCaseOption);
+    parser.addOption(orderOption);
+    parser.addOption(formOption);
+    parser.addOption(caseOption);
+    parser.addOption(inputOption);
+    parser.addOption(applyOption);
+    parser.addOption(suffixOption);
+    parser.addOption(noJournalOption);
+    parser.addOption(planOption);
+    parser.addOption(savePlanOption);
+    parser.addOption(traceOption);
+    parser.process(app);
+    if (parser.isSet(traceOption))
+        Trace::start(parser.value(traceOption));
+#ifdef Q_OS_WIN
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    if (parser.isSet(planOption))
+        return runPlan(parser.value(planOption), parser.isSet(applyOption), !parser.isSet(noJournalOption));
+
+    int ruleIndex = rules.indexOf(parser.value(ruleOption));
+    if (ruleIndex < 0)
+    {
+        fprintf(stderr, "%s\n", qPrintable(tr("沒有這種改名邏輯：%1").arg(parser.value(ruleOption))));
+        return 1;
+    }
+    QList<int> numbers;
+    foreach (const auto& value, parser.values(numberOption))
+    {
+        bool ok;
+        numbers.append(value.toInt(&ok));
+        if (!ok)
+        {
+            fprintf(stderr, "%s\n", qPrintable(tr("數字參數無效：%1").arg(value)));
+            return 1;
+        }
+    }
+    if (parser.isSet(regexOption) || parser.isSet(ignoreCaseOption))
+    {
+        if (ruleNames[ruleIndex].rule != Task::Replace)
+        {
+            fprintf(stderr, "%s\n", qPrintable(tr("--regex 與 --ignore-case 只用於 replace。")));
+            return 1;
+        }
+        int flags = 0;
+        if (parser.isSet(regexOption))
+            flags |= RenamePlan::RegularExpression;
+        if (parser.isSet(ignoreCaseOption))
+            flags |= RenamePlan::CaseInsensitive;
+        numbers.append(flags);
+    }
+    if (parser.isSet(orderOption))
+    {
+        Task::Rule ordered = ruleNames[ruleIndex].rule;
+        if (ordered != Task::OrdinalWithPrefix && ordered != Task::OrdinalWithPrefixReverse && ordered != Task::Template)
+        {
+            fprintf(stderr, "%s\n", qPrintable(tr("--order 只用於 ordinal、ordinal-reverse 與 template。")));
+            return 1;
+        }
+        int order = orders.indexOf(parser.value(orderOption));
+        if (order < 0)
+        {
+            fprintf(stderr, "%s\n", qPrintable(tr("沒有這種排序方式：%1").arg(parser.value(orderOption))));
+            return 1;
+        }
+        numbers.append(order);
+    }
+    if (parser.isSet(formOption) && ruleNames[ruleIndex].rule != Task::Normalize)
+    {
+        fprintf(stderr, "%s\n", qPrintable(tr("--form 只用於 normalize。")));
+        return 1;
+    }
+    if (ruleNames[ruleIndex].rule == Task::Normalize)
+    {
+        int form = forms.indexOf(parser.value(formOption));
+        if (form < 0)
+        {
+            fprintf(stderr, "%s\n", qPrintable(tr("沒有這種正規化形式：%1").arg(parser.value(formOption))));
+            return 1;
+        }
+        numbers.append(form);
+    }
+    if (parser.isSet(caseOption) && ruleNames[ruleIndex].rule != Task::ChangeCase)
+    {
+        fprintf(stderr, "%s\n", qPrintable(tr("--case 只用於 case。")));
+        return 1;
+    }
+    if (ruleNames[ruleIndex].rule == Task::ChangeCase)
+    {
+        int letterCase = cases.indexOf(parser.value(caseOption));
+        if (letterCase < 0)
+        {
+            fprintf(stderr, "%s\n", qPrintable(tr("沒有這種大小寫轉換：%1").arg(parser.value(caseOption))));
+            return 1;
+        }
+        numbers.append(letterCase);
+    }
+    Task::Rule rule = ruleNames[ruleIndex].rule;
+    QStringList strings = parser.values(stringOption);
+    bool detect = (rule == Task::ToUnicode || rule == Task::ToLocale) && strings == QStringList("auto");
+    Task::Mask mask = parser.isSet(extOnlyOption) ? Task::ExtOnly : Task::ExtExcluded;
+    RenamePlan plan(mask, rule, detect ? QStringList(CodePage::names().first()) : strings, numbers);
+    if (!plan.isValid())
+    {
+        fprintf(stderr, "%s\n", qPrintable(plan.errorString()));
+        return 1;
+    }
+
+    Task task;
+    QString inputName = parser.value(inputOption);
+    if (inputName == "-")
+    {
+        if (!readPaths(stdin, task))
+        {
+            fprintf(stderr, "%s\n", qPrintable(tr("無法讀取路徑清單：%1").arg(inputName)));
+            return 1;
+        }
+    }
+    else
+    {
+        // A file is mapped rather than streamed.
+        TaskFile file(inputName);
+        if (!file.read(task))
+        {
+            fprintf(stderr, "%s\n", qPrintable(file.errorString()));
+            return 1;
+        }
+    }
+    if (detect)
+    {
+        // The code page can only be told once every name is in.
+        QString codePage = CodePage::detect(task, rule);
+        if (codePage.isEmpty())
+        {
+            fprintf(stderr, "%s\n", qPrintable(tr("沒有可供判斷代碼頁的非 ASCII 檔名。")));
+            return 0;
+        }
+        fprintf(stderr, "%s\n", qPrintable(tr("偵測到的代碼頁：%1").arg(codePage)));
+        plan = RenamePlan(mask, rule, QStringList(codePage), numbers);
+    }
+
+    static char buffer[1 << 20];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    Task::Resolution resolution = parser.isSet(suffixOption) ? Task::SuffixCollisions : Task::ReportCollisions;
+    task.renameTestAll(plan);
+    reportCollisions(task.preflight(resolution), resolution);
+    if (!parser.isSet(applyOption))
+    {
+        if (parser.isSet(savePlanOption))
+        {
+            TaskFile file(parser.value(savePlanOption));
+            if (!file.write(task))
+            {
+                fprintf(stderr, "%s\n", qPrintable(file.errorString()));
+                return 1;
+            }
+        }
+        writeRenamed(stdout, task);
+        Trace::summarize("preview");
+        return 0;
+    }
+    qsizetype failed = 0;
+    Task::Progress progress = [&failed](qsizetype, qsizetype failures, qsizetype) {
+        failed = failures;
+        return true;
+    };
+    RenameJournal journal;
+    bool journaled = !parser.isSet(noJournalOption);
+    if (journaled && !journal.open())
+    {
+        fprintf(stderr, "%s\n", qPrintable(tr("%1 若仍要改名，請加上 --no-journal。").arg(journal.errorString())));
+        return 1;
+    }
+    task.executeAll(progress, journaled ? &journal : nullptr);
+    return reportRename(task, failed);
+}
@@ -0,0 +1,174 @@
+#include <QTextCodec>
+#include <QtConcurrent/QtConcurrentMap>
+#include <algorithm>
+#include "codepage.h"
+#include "trace.h"
+
+static constexpr qsizetype detectChunkSize = 4096;
+
+CodePage::CodePage()
+    : codec(nullptr)
+    , localeCodec(nullptr)
+{
+}
+
+CodePage::CodePage(const QString& name)
+    : codec(QTextCodec::codecForName(name.toLatin1()))
+    , localeCodec(QTextCodec::codecForLocale())
+{
+}
+
+QString CodePage::detect(const Task& task, Task::Rule rule)
+{
+    // Every candidate reads the whole batch, split into chunks scored in
+    // parallel; the one that yields the fewest broken or unlikely
+    // characters wins. Names made of ASCII alone say nothing and are
+    // skipped, and so is the locale's own code page, which would change
+    // nothing.
+    QTextCodec* localeCodec = QTextCodec::codecForLocale();
+    if (!localeCodec || (rule != Task::ToUnicode && rule != Task::ToLocale))
+        return QString();
+    QList<QTextCodec*> codecs;
+    foreach (const auto& name, CodePage::names())
+    {
+        QTextCodec* codec = QTextCodec::codecForName(name.toLatin1());
+        if (codec && codec->mibEnum() != localeCodec->mibEnum() && !codecs.contains(codec))
+            codecs.append(codec);
+    }
+    QList<qsizetype> begins;
+    for (qsizetype begin = 0; begin < task.size(); begin += detectChunkSize)
+        begins.append(begin);
+    if (codecs.isEmpty() || begins.isEmpty())
+        return QString();
+    auto score = [&task, &codecs, localeCodec, rule](qsizetype begin) {
+        QList<qint64> scores(codecs.size(), 0);
+        bool seen = false;
+        qsizetype end = qMin(begin + detectChunkSize, task.size());
+        for (qsizetype i = begin; i < end; ++i)
+        {
+            QStringView name = task.fileNameView(i, 0);
+            if (CodePage::isAscii(name))
+                continue;
+            seen = true;
+            if (rule == Task::ToUnicode)
+            {
+                QByteArray bytes = localeCodec->fromUnicode(name.data(), int(name.size()));
+                for (qsizetype c = 0; c < codecs.size(); ++c)
+                {
+                    QTextCodec::ConverterState state;
+                    QString text = codecs.at(c)->toUnicode(bytes.constData(), int(bytes.size()), &state);
+                    scores[c] += CodePage::penalty(text, state.invalidChars);
+                }
+            }
+            else
+            {
+                for (qsizetype c = 0; c < codecs.size(); ++c)
+                {
+                    QTextCodec::ConverterState encoded;
+                    QByteArray bytes = codecs.at(c)->fromUnicode(name.data(), int(name.size()), &encoded);
+                    QTextCodec::ConverterState decoded;
+                    QString text = localeCodec->toUnicode(bytes.constData(), int(bytes.size()), &decoded);
+                    scores[c] += CodePage::penalty(text, encoded.invalidChars + decoded.invalidChars);
+                }
+            }
+        }
+        return seen ? scores : QList<qint64>();
+    };
+    auto sum = [](QList<qint64>& totals, const QList<qint64>& scores) {
+        if (totals.isEmpty())
+            totals = scores;
+        else if (!scores.isEmpty())
+            for (qsizetype c = 0; c < totals.size(); ++c)
+                totals[c] += scores.at(c);
+    };
+    QList<qint64> totals = QtConcurrent::blockingMappedReduced<QList<qint64>>(begins, score, sum, QtConcurrent::UnorderedReduce);
+    if (totals.isEmpty())
+        return QString();
+    qsizetype best = std::min_element(totals.cbegin(), totals.cend()) - totals.cbegin();
+    return QString::fromLatin1(codecs.at(best)->name());
+}
+
+bool CodePage::isAscii(QStringView text)
+{
+    // One OR over the whole name rather than a branch per character, so
+    // the loop vectorizes.
+    const char16_t* data = text.utf16();
+    char16_t bits = 0;
+    for (qsizetype i = 0; i < text.size(); ++i)
+        bits |= data[i];
+    return bits < 0x80;
+}
+
+bool CodePage::isValid() const
+{
+    return this->codec && this->localeCodec;
+}
+
+QString CodePage::name() const
+{
+    return this->codec ? QString::fromLatin1(this->codec->name()) : QString();
+}
+
+const QStringList& CodePage::names()
+{
+    // Same order as comboBox_Locale, after its 自動偵測 entry.
+    static const QStringList names = QStringList()
+        << "Shift-JIS"
+        << "GBK"
+        << "CP949"
+        << "Big5"
+        << "Windows-1252"
+        << "IBM437"
+        << "IBM866"
+        << "Windows-874"
+        << "Windows-1250"
+        << "Windows-1251"
+        << "Windows-1253"
+        << "Windows-1254"
+        << "Windows-1255"
+        << "Windows-1256"
+        << "Windows-1257"
+        << "Windows-1258"
+        << "KOI8-R"
+        << "EUC-JP"
+        << "GB18030"
+        << "UTF-8";
+    return names;
+}
+
+void CodePage::toLocale(QString& text) const
+{
+    if (CodePage::isAscii(text))
+        return;
+    QByteArray bytes = this->codec->fromUnicode(text);
+    Trace::add(Trace::BytesConverted, bytes.size());
+    text = this->localeCodec->toUnicode(bytes);
+}
+
+void CodePage::toUnicode(QString& text) const
+{
+    if (CodePage::isAscii(text))
+        return;
+    QByteArray bytes = this->localeCodec->fromUnicode(text);
+    Trace::add(Trace::BytesConverted, bytes.size());
+    text = this->codec->toUnicode(bytes);
+}
+
+qint64 CodePage::penalty(QStringView text, qsizetype invalidChars)
+{
+    // Broken bytes and control or private-use characters weigh the most,
+    // then characters that are rare in names but typical of mojibake. The
+    // length breaks ties: reading a multibyte code page as a single-byte
+    // one spreads every character over several.
+    qint64 score = qint64(invalidChars) * 64 + text.size();
+    const char16_t* data = text.utf16();
+    for (qsizetype i = 0; i < text.size(); ++i)
+    {
+        char16_t u = data[i];
+        if (u < 0x20 || (u >= 0x80 && u < 0xa0) || u == 0xfffd || (u >= 0xe000 && u < 0xf900))
+            score += 64;
+        else if ((u >= 0xa1 && u < 0xc0) || (u >= 0x2500 && u < 0x2600) || (u >= 0xff61 && u < 0xffa0))
+            score += 8;
+    }
+    return score;
+}
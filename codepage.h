@@ -0,0 +1,33 @@
+#ifndef CODEPAGE_H
+#define CODEPAGE_H
+
+#include <QString>
+#include <task.h>
+
+class QTextCodec;
+
+// A legacy code page, resolved once against the locale's own, for the
+// ToUnicode and ToLocale rules. ToUnicode undoes names that were decoded
+// with the locale's code page while written in this one; ToLocale does
+// the reverse. Names made of ASCII alone read the same in every code page
+// supported here and are left as they are without touching a codec.
+class CodePage
+{
+public:
+    CodePage();
+    explicit CodePage(const QString&);
+    static QString detect(const Task&, Task::Rule);
+    static bool isAscii(QStringView);
+    bool isValid() const;
+    QString name() const;
+    static const QStringList& names();
+    void toLocale(QString&) const;
+    void toUnicode(QString&) const;
+
+private:
+    QTextCodec* codec;
+    QTextCodec* localeCodec;
+    static qint64 penalty(QStringView, qsizetype);
+};
+
+#endif // CODEPAGE_H
@@ -0,0 +1,327 @@
+#include <QtAlgorithms>
+#include "codepointindex.h"
+
+#if defined(Q_PROCESSOR_X86) && (defined(Q_CC_GNU) || defined(Q_CC_CLANG))
+#define CODEPOINTINDEX_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Each kernel looks for the need-th code-point start in its direction and
+// returns its position, or returns -1 with need reduced by the number of
+// starts it passed. Forward kernels scan [pos, size), backward kernels
+// scan [0, pos) from the end.
+typedef qsizetype (*Utf8Kernel)(const char*, qsizetype, qsizetype, qsizetype&);
+typedef qsizetype (*Utf16Kernel)(const char16_t*, qsizetype, qsizetype, qsizetype&);
+
+struct Kernels
+{
+    Utf8Kernel forwardUtf8;
+    Utf8Kernel backwardUtf8;
+    Utf16Kernel forwardUtf16;
+    Utf16Kernel backwardUtf16;
+};
+
+inline bool isLeadUtf8(char c)
+{
+    return (c & char(0xc0)) != char(0x80);
+}
+
+inline bool isLeadUtf16(const char16_t* s, qsizetype i)
+{
+    return (s[i] & 0xfc00) != 0xdc00 || i == 0 || (s[i - 1] & 0xfc00) != 0xd800;
+}
+
+inline qsizetype nthLowBit(quint32 mask, qsizetype n)
+{
+    while (--n)
+        mask &= mask - 1;
+    return qCountTrailingZeroBits(mask);
+}
+
+inline qsizetype nthHighBit(quint32 mask, qsizetype n)
+{
+    while (--n)
+        mask &= ~(quint32(0x80000000) >> qCountLeadingZeroBits(mask));
+    return 31 - qCountLeadingZeroBits(mask);
+}
+
+qsizetype forwardUtf8Scalar(const char* s, qsizetype size, qsizetype pos, qsizetype& need)
+{
+    for (; pos < size; ++pos)
+        if (isLeadUtf8(s[pos]) && !--need)
+            return pos;
+    return -1;
+}
+
+qsizetype backwardUtf8Scalar(const char* s, qsizetype, qsizetype pos, qsizetype& need)
+{
+    while (pos > 0)
+        if (isLeadUtf8(s[--pos]) && !--need)
+            return pos;
+    return -1;
+}
+
+qsizetype forwardUtf16Scalar(const char16_t* s, qsizetype size, qsizetype pos, qsizetype& need)
+{
+    for (; pos < size; ++pos)
+        if (isLeadUtf16(s, pos) && !--need)
+            return pos;
+    return -1;
+}
+
+qsizetype backwardUtf16Scalar(const char16_t* s, qsizetype, qsizetype pos, qsizetype& need)
+{
+    while (pos > 0)
+        if (isLeadUtf16(s, --pos) && !--need)
+            return pos;
+    return -1;
+}
+
+#ifdef CODEPOINTINDEX_X86
+// UTF-8 continuation bytes are 0x80-0xbf, i.e. the signed bytes below -64,
+// so one signed compare marks every lead byte of a block. A UTF-16 unit
+// only continues a code point when it is a low surrogate right after a
+// high surrogate, hence the second load shifted back by one unit.
+
+__attribute__((target("sse2"))) quint32 leadMaskUtf8Sse2(const char* p)
+{
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return quint32(_mm_movemask_epi8(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(-65))));
+}
+
+__attribute__((target("sse2"))) quint32 leadMaskUtf16Sse2(const char16_t* p)
+{
+    const __m128i surrogate = _mm_set1_epi16(short(0xfc00));
+    const __m128i high = _mm_set1_epi16(short(0xd800));
+    const __m128i low = _mm_set1_epi16(short(0xdc00));
+    __m128i trail[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        __m128i units = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 8));
+        __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 8 - 1));
+        trail[i] = _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(units, surrogate), low),
+                                 _mm_cmpeq_epi16(_mm_and_si128(previous, surrogate), high));
+    }
+    return ~quint32(_mm_movemask_epi8(_mm_packs_epi16(trail[0], trail[1]))) & 0xffff;
+}
+
+__attribute__((target("sse2"))) qsizetype forwardUtf8Sse2(const char* s, qsizetype size, qsizetype pos, qsizetype& need)
+{
+    for (; pos + 16 <= size; pos += 16)
+    {
+        quint32 mask = leadMaskUtf8Sse2(s + pos);
+        qsizetype count = qPopulationCount(mask);
+        if (count >= need)
+            return pos + nthLowBit(mask, need);
+        need -= count;
+    }
+    return forwardUtf8Scalar(s, size, pos, need);
+}
+
+__attribute__((target("sse2"))) qsizetype backwardUtf8Sse2(const char* s, qsizetype size, qsizetype pos, qsizetype& need)
+{
+    for (; pos >= 16; pos -= 16)
+    {
+        quint32 mask = leadMaskUtf8Sse2(s + pos - 16);
+        qsizetype count = qPopulationCount(mask);
+        if (count >= need)
+            return pos - 16 + nthHighBit(mask, need);
+        need -= count;
+    }
+    return backwardUtf8Scalar(s, size, pos, need);
+}
+
+__attribute__((target("sse2"))) qsizetype forwardUtf16Sse2(const char16_t* s, qsizetype size, qsizetype pos, qsizetype& need)
+{
+    if (pos == 0 && size > 0)
+    {
+        if (!--need)
+            return 0;
+        ++pos;
+    }
+    for (; pos + 16 <= size; pos += 16)
+    {
+        quint32 mask = leadMaskUtf16Sse2(s + pos);
+        qsizetype count = qPopulationCount(mask);
+        if (count >= need)
+            return pos + nthLowBit(mask, need);
+        need -= count;
+    }
+    return forwardUtf16Scalar(s, size, pos, need);
+}
+
+__attribute__((target("sse2"))) qsizetype backwardUtf16Sse2(const char16_t* s, qsizetype size, qsizetype pos, qsizetype& need)
+{
+    for (; pos >= 17; pos -= 16)
+    {
+        quint32 mask = leadMaskUtf16Sse2(s + pos - 16);
+        qsizetype count = qPopulationCount(mask);
+        if (count >= need)
+            return pos - 16 + nthHighBit(mask, need);
+        need -= count;
+    }
+    return backwardUtf16Scalar(s, size, pos, need);
+}
+
+__attribute__((target("avx2"))) quint32 leadMaskUtf8Avx2(const char* p)
+{
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    return quint32(_mm256_movemask_epi8(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(-65))));
+}
+
+// Two mask bits per unit; a unit is a lead exactly when both are set.
+__attribute__((target("avx2"))) quint32 leadMaskUtf16Avx2(const char16_t* p)
+{
+    const __m256i surrogate = _mm256_set1_epi16(short(0xfc00));
+    __m256i units = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i previous = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p - 1));
+    __m256i trail = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_and_si256(units, surrogate), _mm256_set1_epi16(short(0xdc00))),
+                                     _mm256_cmpeq_epi16(_mm256_and_si256(previous, surrogate), _mm256_set1_epi16(short(0xd800))));
+    return ~quint32(_mm256_movemask_epi8(trail));
+}
+
+__attribute__((target("avx2"))) qsizetype forwardUtf8Avx2(const char* s, qsizetype size, qsizetype pos, qsizetype& need)
+{
+    for (; pos + 32 <= size; pos += 32)
+    {
+        quint32 mask = leadMaskUtf8Avx2(s + pos);
+        qsizetype count = qPopulationCount(mask);
+        if (count >= need)
+            return pos + nthLowBit(mask, need);
+        need -= count;
+    }
+    return forwardUtf8Sse2(s, size, pos, need);
+}
+
+__attribute__((target("avx2"))) qsizetype backwardUtf8Avx2(const char* s, qsizetype size, qsizetype pos, qsizetype& need)
+{
+    for (; pos >= 32; pos -= 32)
+    {
+        quint32 mask = leadMaskUtf8Avx2(s + pos - 32);
+        qsizetype count = qPopulationCount(mask);
+        if (count >= need)
+            return pos - 32 + nthHighBit(mask, need);
+        need -= count;
+    }
+    return backwardUtf8Sse2(s, size, pos, need);
+}
+
+__attribute__((target("avx2"))) qsizetype forwardUtf16Avx2(const char16_t* s, qsizetype size, qsizetype pos, qsizetype& need)
+{
+    if (pos == 0 && size > 0)
+    {
+        if (!--need)
+            return 0;
+        ++pos;
+    }
+    for (; pos + 16 <= size; pos += 16)
+    {
+        quint32 mask = leadMaskUtf16Avx2(s + pos);
+        qsizetype count = qPopulationCount(mask) / 2;
+        if (count >= need)
+            return pos + nthLowBit(mask, need * 2) / 2;
+        need -= count;
+    }
+    return forwardUtf16Scalar(s, size, pos, need);
+}
+
+__attribute__((target("avx2"))) qsizetype backwardUtf16Avx2(const char16_t* s, qsizetype size, qsizetype pos, qsizetype& need)
+{
+    for (; pos >= 17; pos -= 16)
+    {
+        quint32 mask = leadMaskUtf16Avx2(s + pos - 16);
+        qsizetype count = qPopulationCount(mask) / 2;
+        if (count >= need)
+            return pos - 16 + nthHighBit(mask, need * 2) / 2;
+        need -= count;
+    }
+    return backwardUtf16Scalar(s, size, pos, need);
+}
+#endif
+
+Kernels resolveKernels()
+{
+    Kernels kernels = {forwardUtf8Scalar, backwardUtf8Scalar, forwardUtf16Scalar, backwardUtf16Scalar};
+#ifdef CODEPOINTINDEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels.forwardUtf8 = forwardUtf8Avx2;
+        kernels.backwardUtf8 = backwardUtf8Avx2;
+        kernels.forwardUtf16 = forwardUtf16Avx2;
+        kernels.backwardUtf16 = backwardUtf16Avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        kernels.forwardUtf8 = forwardUtf8Sse2;
+        kernels.backwardUtf8 = backwardUtf8Sse2;
+        kernels.forwardUtf16 = forwardUtf16Sse2;
+        kernels.backwardUtf16 = backwardUtf16Sse2;
+    }
+#endif
+    return kernels;
+}
+
+const Kernels& kernels()
+{
+    static const Kernels resolved = resolveKernels();
+    return resolved;
+}
+
+template <typename Char, typename Kernel>
+qsizetype seek(const Char* s, qsizetype size, qsizetype base, qsizetype offset, Kernel forward, Kernel backward)
+{
+    if (offset > 0)
+    {
+        qsizetype need = offset + 1;
+        if (base < 0)
+        {
+            if (need <= -base)
+                return base + need - 1;
+            need += base;
+            base = 0;
+        }
+        if (base < size)
+        {
+            qsizetype found = forward(s, size, base, need);
+            if (found >= 0)
+                return found;
+            base = size;
+        }
+        return base + need - 1;
+    }
+    else if (offset < 0)
+    {
+        qsizetype need = -offset;
+        if (base > size)
+        {
+            if (need <= base - size)
+                return base - need;
+            need -= base - size;
+            base = size;
+        }
+        if (base > 0)
+        {
+            qsizetype found = backward(s, size, base, need);
+            if (found >= 0)
+                return found;
+            base = 0;
+        }
+        return base - need;
+    }
+    return base;
+}
+
+}
+
+qsizetype CodePointIndex::seekUtf16(const char16_t* s, qsizetype size, qsizetype base, qsizetype offset)
+{
+    return seek(s, size, base, offset, kernels().forwardUtf16, kernels().backwardUtf16);
+}
+
+qsizetype CodePointIndex::seekUtf8(const char* s, qsizetype size, qsizetype base, qsizetype offset)
+{
+    return seek(s, size, base, offset, kernels().forwardUtf8, kernels().backwardUtf8);
+}
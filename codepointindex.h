@@ -0,0 +1,19 @@
+#ifndef CODEPOINTINDEX_H
+#define CODEPOINTINDEX_H
+
+#include <QtGlobal>
+
+// Code-point seeking over UTF-8 and UTF-16 buffers. Both functions move
+// from base by offset code points, the way Task::indexofUtf8 always did:
+// a positive offset lands on the start of the offset-th code point after
+// base, a negative one on the start of the offset-th code point before
+// base, and every position outside the buffer counts as one code point.
+// The scan uses SSE2 or AVX2 when the CPU has them.
+class CodePointIndex
+{
+public:
+    static qsizetype seekUtf16(const char16_t*, qsizetype, qsizetype, qsizetype);
+    static qsizetype seekUtf8(const char*, qsizetype, qsizetype, qsizetype);
+};
+
+#endif // CODEPOINTINDEX_H
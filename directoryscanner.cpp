@@ -0,0 +1,289 @@
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+#include "directoryscanner.h"
+#include "direntreader.h"
+#include "trace.h"
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+DirectoryScanner::DirectoryScanner(const QStringList& roots, int maxDepth, EntryType entryType, QObject *parent)
+    : QObject(parent)
+    , roots(roots)
+    , maxDepth(maxDepth)
+    , entryType(entryType)
+    , busy(0)
+    , found(0)
+    , canceled(0)
+{
+    this->connect(&this->watcher, &QFutureWatcher<void>::finished, this, &DirectoryScanner::finished);
+}
+
+DirectoryScanner::~DirectoryScanner()
+{
+    this->cancel();
+    this->wait();
+}
+
+void DirectoryScanner::cancel()
+{
+    this->canceled.storeRelaxed(1);
+    QMutexLocker locker(&this->mutex);
+    this->wakeup.wakeAll();
+}
+
+qsizetype DirectoryScanner::count() const
+{
+    QMutexLocker locker(&this->mutex);
+    return this->found;
+}
+
+bool DirectoryScanner::isCanceled() const
+{
+    return this->canceled.loadRelaxed();
+}
+
+bool DirectoryScanner::isRunning() const
+{
+    return this->watcher.isRunning();
+}
+
+void DirectoryScanner::start()
+{
+    // The dropped paths hang below a node of their own, in the order they
+    // were dropped; the queue is taken from its end.
+    this->nodes.append(Node());
+    this->nodes.first().read = true;
+    this->cursor.append(0);
+    foreach (const auto& root, this->roots)
+    {
+        Directory directory;
+        directory.path = root;
+        directory.depth = 0;
+        directory.node = this->nodes.size();
+        this->nodes.first().children.append(directory.node);
+        this->nodes.append(Node());
+        this->queue.prepend(directory);
+    }
+    // Reading directories mostly waits on the filesystem, so every thread
+    // of the pool walks; the first one also waits for the others.
+    int workers = qMax(QThread::idealThreadCount(), 1);
+    this->pool.setMaxThreadCount(workers);
+    this->watcher.setFuture(QtConcurrent::run(&this->pool, [this, workers]() {
+        QList<QFuture<void>> helpers;
+        for (int i = 1; i < workers; ++i)
+            helpers.append(QtConcurrent::run(&this->pool, [this]() {
+                this->walk();
+            }));
+        this->walk();
+        for (auto& helper : helpers)
+            helper.waitForFinished();
+    }));
+}
+
+QList<DirectoryScanner::Entries> DirectoryScanner::takeEntries()
+{
+    QMutexLocker locker(&this->mutex);
+    QList<Entries> entries;
+    entries.swap(this->ready);
+    return entries;
+}
+
+void DirectoryScanner::wait()
+{
+    this->watcher.waitForFinished();
+}
+
+bool DirectoryScanner::accepts(bool isDir) const
+{
+    switch (this->entryType)
+    {
+        case DirectoryScanner::FilesOnly:
+        return !isDir;
+        case DirectoryScanner::DirsOnly:
+        return isDir;
+        default:
+        return true;
+    }
+}
+
+bool DirectoryScanner::descends(int depth) const
+{
+    return !this->maxDepth || depth < this->maxDepth;
+}
+
+void DirectoryScanner::publish()
+{
+    // Walks the tree in order from where the last call stopped, handing
+    // over each directory read on the way, up to the first one still
+    // being read. Called with the mutex held.
+    while (!this->cursor.isEmpty())
+    {
+        Node& node = this->nodes[this->cursor.last()];
+        if (!node.read)
+            break;
+        if (!node.published)
+        {
+            node.published = true;
+            if (!node.entries.fileNames.isEmpty())
+            {
+                this->found += node.entries.fileNames.size();
+                this->ready.append(std::move(node.entries));
+            }
+            node.entries = Entries();
+        }
+        if (node.nextChild < node.children.size())
+            this->cursor.append(node.children.at(node.nextChild++));
+        else
+            this->cursor.removeLast();
+    }
+}
+
+void DirectoryScanner::readDirectory(const Directory& directory, Entries& entries, QList<Directory>& children, QByteArray& buffer)
+{
+    entries.dirPrefix = directory.path.endsWith(QChar('/')) ? directory.path : directory.path + QChar('/');
+#ifdef Q_OS_LINUX
+    int fd = open(QFile::encodeName(directory.path).constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    Trace::add(Trace::Syscalls);
+    bool isFile = fd < 0 && (errno == ENOTDIR || errno == ELOOP);
+    if (fd < 0 && !isFile)
+    {
+        qWarning() << "Cannot read directory " << directory.path << ": " << strerror(errno);
+        return;
+    }
+#else
+    QFileInfo info(directory.path);
+    bool isFile = directory.depth == 0 && (!info.isDir() || info.isSymLink());
+#endif
+    if (isFile)
+    {
+        // A dropped file, or a symbolic link, is taken as it is rather than
+        // followed.
+        if (directory.depth == 0 && this->accepts(false))
+        {
+            qsizetype separator = directory.path.lastIndexOf(QChar('/'));
+            entries.dirPrefix = directory.path.left(separator + 1);
+            entries.fileNames.append(directory.path.mid(separator + 1));
+        }
+        return;
+    }
+#ifdef Q_OS_LINUX
+    DirentReader reader(fd, buffer, directory.path);
+    while (!this->isCanceled() && reader.next())
+    {
+        const char* name = reader.name();
+        bool isDir = reader.type() == DT_DIR;
+        if (reader.type() == DT_UNKNOWN)
+        {
+            struct stat status;
+            Trace::add(Trace::Syscalls);
+            if (fstatat(fd, name, &status, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            isDir = S_ISDIR(status.st_mode);
+        }
+        QString fileName = QFile::decodeName(name);
+        if (isDir && this->descends(directory.depth + 1))
+        {
+            Directory child;
+            child.path = entries.dirPrefix + fileName;
+            child.depth = directory.depth + 1;
+            children.append(child);
+        }
+        if (this->accepts(isDir))
+            entries.fileNames.append(fileName);
+    }
+    close(fd);
+#else
+    Q_UNUSED(buffer);
+    QDirIterator it(directory.path, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    while (it.hasNext() && !this->isCanceled())
+    {
+        it.next();
+        QFileInfo entry = it.fileInfo();
+        bool isDir = entry.isDir() && !entry.isSymLink();
+        if (isDir && this->descends(directory.depth + 1))
+        {
+            Directory child;
+            child.path = entries.dirPrefix + entry.fileName();
+            child.depth = directory.depth + 1;
+            children.append(child);
+        }
+        if (this->accepts(isDir))
+            entries.fileNames.append(entry.fileName());
+    }
+#endif
+}
+
+void DirectoryScanner::walk()
+{
+    Trace::Span span("scanDirectories");
+    QByteArray buffer(DirectoryScanner::bufferSize, Qt::Uninitialized);
+    QList<Directory> children;
+    forever
+    {
+        Directory directory;
+        {
+            // The walk is over once no directory is queued and no worker
+            // is still reading one that might add more.
+            QMutexLocker locker(&this->mutex);
+            while (this->queue.isEmpty() && this->busy && !this->isCanceled())
+                this->wakeup.wait(&this->mutex);
+            if (this->queue.isEmpty() || this->isCanceled())
+            {
+                this->wakeup.wakeAll();
+                return;
+            }
+            // Taking the newest directory keeps the walk depth first, which
+            // bounds the queue by the width of the tree rather than by the
+            // number of directories.
+            directory = this->queue.takeLast();
+            ++this->busy;
+        }
+        Entries entries;
+        children.clear();
+        this->readDirectory(directory, entries, children, buffer);
+        Trace::add(Trace::Files, entries.fileNames.size());
+        // Entries and subdirectories are sorted so that ordinals follow
+        // names rather than the order the filesystem happens to return.
+        std::sort(entries.fileNames.begin(), entries.fileNames.end());
+        std::sort(children.begin(), children.end(), [](const Directory& a, const Directory& b) {
+            return a.path < b.path;
+        });
+        bool signal;
+        {
+            QMutexLocker locker(&this->mutex);
+            qsizetype node = directory.node;
+            this->nodes[node].entries = std::move(entries);
+            this->nodes[node].read = true;
+            for (auto& child : children)
+            {
+                child.node = this->nodes.size();
+                this->nodes[node].children.append(child.node);
+                this->nodes.append(Node());
+            }
+            // Queued last first, so the first child is read next.
+            std::for_each(children.crbegin(), children.crend(), [this](const Directory& child) {
+                this->queue.append(child);
+            });
+            bool wasEmpty = this->ready.isEmpty();
+            this->publish();
+            signal = wasEmpty && !this->ready.isEmpty();
+            --this->busy;
+            this->wakeup.wakeAll();
+        }
+        // The GUI thread takes everything published so far on each signal,
+        // so one signal per drained list is enough.
+        if (signal)
+            emit this->entriesReady();
+    }
+}
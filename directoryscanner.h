@@ -0,0 +1,86 @@
+#ifndef DIRECTORYSCANNER_H
+#define DIRECTORYSCANNER_H
+
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+// Expands dropped paths into the entries of the directories below them.
+// Directories are read in parallel on a thread pool of the scanner's own,
+// as its walkers wait on each other and would starve previews and other
+// work queued on the global one. Their entries are handed to the GUI
+// thread one directory at a time, so a task can fill up while the walk
+// goes on; they arrive in the order a walk by name would visit the
+// directories, however the reads interleave. On Linux directories are
+// read with getdents64 and entries are classified by d_type; an entry is
+// only stat'ed when the filesystem does not report its type.
+class DirectoryScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum EntryType {FilesAndDirs, FilesOnly, DirsOnly};
+    struct Entries
+    {
+        QString dirPrefix;
+        QStringList fileNames;
+    };
+    // A maximum depth of 0 walks the whole tree; 1 only lists the entries
+    // directly inside the dropped directories.
+    DirectoryScanner(const QStringList&, int, EntryType, QObject *parent = nullptr);
+    ~DirectoryScanner();
+    void cancel();
+    qsizetype count() const;
+    bool isCanceled() const;
+    bool isRunning() const;
+    void start();
+    QList<Entries> takeEntries();
+    void wait();
+
+signals:
+    void entriesReady();
+    void finished();
+
+private:
+    struct Directory
+    {
+        QString path;
+        int depth;
+        qsizetype node;
+    };
+    // A directory's place in the walk: its entries wait here until every
+    // directory before it has been published.
+    struct Node
+    {
+        Entries entries;
+        bool read = false;
+        bool published = false;
+        QList<qsizetype> children;
+        qsizetype nextChild = 0;
+    };
+    static constexpr qsizetype bufferSize = 64 * 1024;
+    QStringList roots;
+    int maxDepth;
+    EntryType entryType;
+    mutable QMutex mutex;
+    QWaitCondition wakeup;
+    QList<Directory> queue;
+    int busy;
+    QList<Node> nodes;
+    QList<qsizetype> cursor;
+    QList<Entries> ready;
+    qsizetype found;
+    QAtomicInt canceled;
+    QThreadPool pool;
+    QFutureWatcher<void> watcher;
+    bool accepts(bool) const;
+    bool descends(int) const;
+    void publish();
+    void readDirectory(const Directory&, Entries&, QList<Directory>&, QByteArray&);
+    void walk();
+};
+
+#endif // DIRECTORYSCANNER_H
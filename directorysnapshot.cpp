@@ -0,0 +1,68 @@
+#include <QDirIterator>
+#include <QFile>
+#include "directorysnapshot.h"
+#include "direntreader.h"
+#include "trace.h"
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+QString DirectorySnapshot::key(QStringView fileName)
+{
+    // Windows and macOS file systems are case-insensitive by default, so
+    // two names differing only in case are the same file there.
+#if defined(Q_OS_WIN) || defined(Q_OS_MACOS)
+    return fileName.toCaseFolded();
+#else
+    return fileName.toString();
+#endif
+}
+
+QSet<QString> DirectorySnapshot::names(const QString& dirPrefix)
+{
+    {
+        QMutexLocker locker(&this->mutex);
+        auto it = this->directories.constFind(dirPrefix);
+        if (it != this->directories.cend())
+            return it.value();
+    }
+    // Reading happens outside the lock, so directories can be read in
+    // parallel; two threads reading the same one just keep the first.
+    QSet<QString> names = DirectorySnapshot::read(dirPrefix);
+    QMutexLocker locker(&this->mutex);
+    return *this->directories.insert(dirPrefix, names);
+}
+
+QSet<QString> DirectorySnapshot::read(const QString& dirPrefix)
+{
+    Trace::Span span("readSnapshot");
+    QSet<QString> names;
+    QString path = dirPrefix.isEmpty() ? QString(".") : dirPrefix;
+#ifdef Q_OS_LINUX
+    int fd = open(QFile::encodeName(path).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    Trace::add(Trace::Syscalls);
+    if (fd < 0)
+    {
+        qWarning() << "Cannot read directory " << path << ": " << strerror(errno);
+        return names;
+    }
+    QByteArray buffer(DirectorySnapshot::bufferSize, Qt::Uninitialized);
+    DirentReader reader(fd, buffer, path);
+    while (reader.next())
+        names.insert(DirectorySnapshot::key(QFile::decodeName(reader.name())));
+    close(fd);
+#else
+    QDirIterator it(path, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    while (it.hasNext())
+    {
+        it.next();
+        names.insert(DirectorySnapshot::key(it.fileName()));
+    }
+#endif
+    Trace::add(Trace::Files, names.size());
+    return names;
+}
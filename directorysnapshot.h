@@ -0,0 +1,27 @@
+#ifndef DIRECTORYSNAPSHOT_H
+#define DIRECTORYSNAPSHOT_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+
+// The names in some directories, for checking new names against. Each
+// directory is read once, on first use, into a hash set that is kept for
+// later lookups, so one snapshot can serve preview after preview as long
+// as nothing is renamed for real. Names are kept as keys(), folded where
+// the file system ignores case; names() may be called from any thread.
+class DirectorySnapshot
+{
+public:
+    static QString key(QStringView);
+    QSet<QString> names(const QString&);
+
+private:
+    static constexpr qsizetype bufferSize = 64 * 1024;
+    QMutex mutex;
+    QHash<QString, QSet<QString>> directories;
+    static QSet<QString> read(const QString&);
+};
+
+#endif // DIRECTORYSNAPSHOT_H
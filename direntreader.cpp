@@ -0,0 +1,70 @@
+#include <QDebug>
+#include "direntreader.h"
+#include "trace.h"
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Record layout returned by getdents64, which glibc does not declare.
+struct Dirent64
+{
+    quint64 ino;
+    qint64 off;
+    unsigned short reclen;
+    unsigned char type;
+    char name[1];
+};
+#endif
+
+DirentReader::DirentReader(int fd, QByteArray& buffer, const QString& path)
+    : fd(fd)
+    , buffer(buffer)
+    , path(path)
+    , size(0)
+    , offset(0)
+    , entryName(nullptr)
+    , entryType(0)
+{
+}
+
+const char* DirentReader::name() const
+{
+    return this->entryName;
+}
+
+bool DirentReader::next()
+{
+#ifdef Q_OS_LINUX
+    forever
+    {
+        if (this->offset >= this->size)
+        {
+            this->size = syscall(SYS_getdents64, this->fd, this->buffer.data(), this->buffer.size());
+            this->offset = 0;
+            Trace::add(Trace::Syscalls);
+            if (this->size < 0)
+                qWarning() << "Cannot read directory " << this->path << ": " << strerror(errno);
+            if (this->size <= 0)
+                return false;
+        }
+        const Dirent64* entry = reinterpret_cast<const Dirent64*>(this->buffer.constData() + this->offset);
+        this->offset += entry->reclen;
+        const char* name = entry->name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        this->entryName = name;
+        this->entryType = entry->type;
+        return true;
+    }
+#else
+    return false;
+#endif
+}
+
+unsigned char DirentReader::type() const
+{
+    return this->entryType;
+}
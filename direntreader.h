@@ -0,0 +1,30 @@
+#ifndef DIRENTREADER_H
+#define DIRENTREADER_H
+
+#include <QByteArray>
+#include <QString>
+
+// The entries of an open directory, read with getdents64 a buffer at a
+// time; "." and ".." are skipped. Each entry comes as its raw name and
+// the d_type the filesystem reports, DT_UNKNOWN when it does not. Only
+// Linux has getdents64; elsewhere next() is always false and callers read
+// directories through Qt instead.
+class DirentReader
+{
+public:
+    DirentReader(int, QByteArray&, const QString&);
+    const char* name() const;
+    bool next();
+    unsigned char type() const;
+
+private:
+    int fd;
+    QByteArray& buffer;
+    const QString& path;
+    long size;
+    long offset;
+    const char* entryName;
+    unsigned char entryType;
+};
+
+#endif // DIRENTREADER_H
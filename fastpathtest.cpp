@@ -0,0 +1,410 @@
+#include <QFileInfo>
+#include <QRandomGenerator>
+#include <QtTest>
+#include "codepointindex.h"
+#include "renameplan.h"
+#include "task.h"
+#include "unicodeform.h"
+
+// Checks the fast paths of the rename engine against the plain code they
+// stand in for: each compiled rule against the conversion the rules ran
+// before they were compiled, a chain against its rules one by one, and
+// the vectorized scans against loops over one code unit at a time, and
+// the Unicode fast paths against QString's own conversions.
+
+struct RuleCase
+{
+    const char* name;
+    Task::Mask mask;
+    Task::Rule rule;
+    QList<QString> strings;
+    QList<int> numbers;
+};
+
+static QList<RuleCase> ruleCases()
+{
+    return {
+        {"insert", Task::ExtExcluded, Task::Insert, {"[x]"}, {2}},
+        {"insertPast", Task::ExtExcluded, Task::Insert, {"[x]"}, {12}},
+        {"insertLast", Task::ExtExcluded, Task::InsertLast, {"[x]"}, {1}},
+        {"insertLastPast", Task::ExtExcluded, Task::InsertLast, {"[x]"}, {12}},
+        {"insertSuffix", Task::ExtOnly, Task::Insert, {"x"}, {1}},
+        {"delete", Task::ExtExcluded, Task::Delete, {}, {1, 2}},
+        {"deletePast", Task::ExtExcluded, Task::Delete, {}, {3, 20}},
+        {"deleteLast", Task::ExtExcluded, Task::DeleteLast, {}, {1, 2}},
+        {"deleteLastPast", Task::ExtExcluded, Task::DeleteLast, {}, {2, 20}},
+        {"deleteSuffix", Task::ExtOnly, Task::DeleteLast, {}, {0, 1}},
+        {"replaceShort", Task::ExtExcluded, Task::Replace, {"a", "AA"}, {}},
+        {"replaceLong", Task::ExtExcluded, Task::Replace, {"name", "名"}, {}},
+        {"replaceCaseInsensitive", Task::ExtExcluded, Task::Replace, {"NAME", "n"}, {RenamePlan::CaseInsensitive}},
+        {"replaceRegex", Task::ExtExcluded, Task::Replace, {"(\\d+)", "<\\1>"}, {RenamePlan::RegularExpression}},
+        {"replaceRegexGroupZero", Task::ExtExcluded, Task::Replace, {"(\\d)(\\d)", "<\\0\\01\\2\\21>"}, {RenamePlan::RegularExpression}},
+    };
+}
+
+static const QStringList names = {
+    "name.txt",
+    "a name with spaces.tar.gz",
+    "no-suffix",
+    ".hidden",
+    "trailing.",
+    "file 12 of 345.jpg",
+    "中文檔名.doc",
+    "\U0001F600smile\U0001F600.png",
+    "\U0002000Bext-b.txt",
+    "café.txt",
+    "がガ.md",
+    "NAME.TXT",
+};
+
+// The rules as they ran before they were compiled: Insert and Delete on
+// UTF-8 with Task::indexofUtf8, Replace through QString.
+static QString referenceRule(const RuleCase& ruleCase, QString modText)
+{
+    QByteArray modTextUtf8 = modText.toUtf8();
+    switch (ruleCase.rule)
+    {
+        case Task::Insert:
+        return QString::fromUtf8(modTextUtf8.insert(Task::indexofUtf8(modTextUtf8, 0, ruleCase.numbers.at(0)), ruleCase.strings.at(0).toUtf8()));
+        case Task::InsertLast:
+        {
+            qsizetype posUtf8 = Task::indexofUtf8(modTextUtf8, modTextUtf8.size(), 0 - ruleCase.numbers.at(0));
+            if (posUtf8 < 0)
+                modTextUtf8.prepend(QByteArray(0 - posUtf8, ' ')).insert(0, ruleCase.strings.at(0).toUtf8());
+            else
+                modTextUtf8.insert(posUtf8, ruleCase.strings.at(0).toUtf8());
+        }
+        return QString::fromUtf8(modTextUtf8);
+        case Task::Delete:
+        {
+            qsizetype posUtf8begin = Task::indexofUtf8(modTextUtf8, 0, ruleCase.numbers.at(0));
+            qsizetype posUtf8end = Task::indexofUtf8(modTextUtf8, posUtf8begin, ruleCase.numbers.at(1));
+            modTextUtf8.remove(posUtf8begin, posUtf8end - posUtf8begin);
+        }
+        return QString::fromUtf8(modTextUtf8);
+        case Task::DeleteLast:
+        {
+            qsizetype posUtf8end = Task::indexofUtf8(modTextUtf8, modTextUtf8.size(), 0 - ruleCase.numbers.at(0));
+            qsizetype posUtf8begin = Task::indexofUtf8(modTextUtf8, posUtf8end, 0 - ruleCase.numbers.at(1));
+            if (posUtf8begin < 0)
+                posUtf8begin = 0;
+            modTextUtf8.remove(posUtf8begin, posUtf8end - posUtf8begin);
+        }
+        return QString::fromUtf8(modTextUtf8);
+        case Task::Replace:
+            if (ruleCase.numbers.value(0) & RenamePlan::RegularExpression)
+                return modText.replace(QRegularExpression(ruleCase.strings.at(0), QRegularExpression::UseUnicodePropertiesOption), ruleCase.strings.at(1));
+        return modText.replace(ruleCase.strings.at(0), ruleCase.strings.at(1), ruleCase.numbers.value(0) & RenamePlan::CaseInsensitive ? Qt::CaseInsensitive : Qt::CaseSensitive);
+        default:
+        return modText;
+    }
+}
+
+// The split into base name and suffix, and the way back, as QFileInfo did
+// it before the rules were compiled.
+static QString referenceRename(const RuleCase& ruleCase, const QString& fileName)
+{
+    QFileInfo file(fileName);
+    if (ruleCase.mask == Task::ExtExcluded)
+    {
+        QString modFileName = referenceRule(ruleCase, file.completeBaseName());
+        if (fileName.contains(QChar('.')) || !file.suffix().isEmpty())
+            modFileName += "." + file.suffix();
+        return modFileName;
+    }
+    QString modText = referenceRule(ruleCase, file.suffix());
+    QString modFileName = file.completeBaseName();
+    if (fileName.contains(QChar('.')) || !modText.isEmpty())
+        modFileName += "." + modText;
+    return modFileName;
+}
+
+// The loop Task::indexofUtf8 always ran, for any encoding: positions
+// outside the buffer count as one code point each.
+template <typename Char, typename IsLead>
+static qsizetype referenceSeek(const Char* s, qsizetype size, qsizetype base, qsizetype offset, IsLead isLead)
+{
+    if (offset > 0)
+    {
+        for (++offset; offset; ++base)
+            if (base < 0 || base >= size || isLead(s, base))
+                --offset;
+        return base - 1;
+    }
+    while (offset < 0)
+    {
+        --base;
+        if (base < 0 || base >= size || isLead(s, base))
+            ++offset;
+    }
+    return base;
+}
+
+static bool isLeadUtf8(const char* s, qsizetype i)
+{
+    return (s[i] & char(0xc0)) != char(0x80);
+}
+
+static bool isLeadUtf16(const char16_t* s, qsizetype i)
+{
+    return !QChar::isLowSurrogate(s[i]) || i == 0 || !QChar::isHighSurrogate(s[i - 1]);
+}
+
+// Names on either side of the fast paths: composed and decomposed forms,
+// a combining mark after a base the scan lets through, kana with a
+// voicing mark, surrogate pairs, compatibility characters, and the same
+// around the edges of the 8 and 16 unit blocks of the scan.
+static QStringList unicodeInputs()
+{
+    QStringList inputs = {
+        "",
+        "plain ascii 123",
+        "MiXeD cAsE wOrDs_and-dashes",
+        "caf\u00e9",
+        "cafe\u0301",
+        "\u304b\u3099",
+        "\u30ab\u3099",
+        "\u304c\u30ac",
+        "\u3071\u309a",
+        "\u4e2d\u6587\u6a94\u540d",
+        "\U0001f600",
+        "\U0002000b\U0002f800",
+        "\ufb01le",
+        "\u212b\u00c5",
+        "\u00a0\u2460",
+        "\u00df and \u01c6",
+        "\u0130stanbul",
+        "\u1f00\u0345",
+    };
+    const QStringList tails = {"e\u0301", "\u304b\u3099", "\U0001f600", "\u00e9", "\u00a0"};
+    for (int size : {7, 8, 9, 15, 16, 17, 31, 32, 33})
+    {
+        foreach (const auto& tail, tails)
+        {
+            inputs.append(QString(size - 1, QChar('a')) + tail);
+            inputs.append(tail + QString(size - 1, QChar('a')));
+        }
+    }
+    return inputs;
+}
+
+// Title case as the slow path does it, code point by code point.
+static QString referenceTitleCase(const QString& text)
+{
+    QString result;
+    bool wordStart = true;
+    for (qsizetype i = 0; i < text.size(); ++i)
+    {
+        char32_t c = text.at(i).unicode();
+        if (QChar::isHighSurrogate(c) && i + 1 < text.size() && text.at(i + 1).isLowSurrogate())
+            c = QChar::surrogateToUcs4(char16_t(c), text.at(++i).unicode());
+        result += QChar::fromUcs4(wordStart ? QChar::toTitleCase(c) : QChar::toLower(c));
+        wordStart = !QChar::isLetterOrNumber(c) && !QChar::isMark(c);
+    }
+    return result;
+}
+
+class FastPathTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void caseMatchesQt();
+    void chainMatchesRules();
+    void normalizeMatchesQt();
+    void planMatchesRules_data();
+    void planMatchesRules();
+    void seekUtf16MatchesScalar();
+    void seekUtf8MatchesScalar();
+    void untouchedAtEveryPosition();
+};
+
+void FastPathTest::caseMatchesQt()
+{
+    foreach (const auto& input, unicodeInputs())
+    {
+        QString upper = input;
+        UnicodeForm::changeCase(upper, UnicodeForm::UpperCase);
+        QCOMPARE(upper, input.toUpper());
+        QString lower = input;
+        UnicodeForm::changeCase(lower, UnicodeForm::LowerCase);
+        QCOMPARE(lower, input.toLower());
+        QString title = input;
+        UnicodeForm::changeCase(title, UnicodeForm::TitleCase);
+        QCOMPARE(title, referenceTitleCase(input));
+    }
+}
+
+void FastPathTest::chainMatchesRules()
+{
+    Task task;
+    foreach (const auto& name, names)
+        task.append(name);
+    RenamePlan chain;
+    QList<RenamePlan> rules;
+    foreach (const auto& ruleCase, ruleCases())
+    {
+        rules.append(RenamePlan(ruleCase.mask, ruleCase.rule, ruleCase.strings, ruleCase.numbers));
+        rules.last().bind(task);
+        chain.append(rules.last());
+    }
+    rules.append(RenamePlan(Task::ExtExcluded, Task::OrdinalWithPrefix, {"#", "007"}, {}));
+    rules.last().bind(task);
+    chain.append(rules.last());
+    QVERIFY2(chain.isValid(), qPrintable(chain.errorString()));
+    chain.bind(task);
+    for (qsizetype i = 0; i < names.size(); ++i)
+    {
+        QString chained;
+        QVERIFY(chain.apply(names.at(i), i, chained));
+        QString stepped = names.at(i);
+        foreach (const auto& rule, rules)
+        {
+            QString next;
+            QVERIFY(rule.apply(stepped, i, next));
+            stepped = next;
+        }
+        QCOMPARE(chained, stepped);
+    }
+}
+
+void FastPathTest::normalizeMatchesQt()
+{
+    const QString::NormalizationForm forms[] = {QString::NormalizationForm_D, QString::NormalizationForm_C, QString::NormalizationForm_KD, QString::NormalizationForm_KC};
+    foreach (const auto& input, unicodeInputs())
+    {
+        for (auto form : forms)
+        {
+            // A name the scan lets through has to be in the form already.
+            QString expected = input.normalized(form);
+            if (UnicodeForm::isUntouched(input, form))
+                QCOMPARE(input, expected);
+            QString normalized = input;
+            UnicodeForm::normalize(normalized, form);
+            QCOMPARE(normalized, expected);
+        }
+    }
+}
+
+void FastPathTest::planMatchesRules_data()
+{
+    QTest::addColumn<int>("ruleCase");
+    QList<RuleCase> cases = ruleCases();
+    for (int i = 0; i < cases.size(); ++i)
+        QTest::newRow(cases.at(i).name) << i;
+}
+
+void FastPathTest::planMatchesRules()
+{
+    QFETCH(int, ruleCase);
+    RuleCase rule = ruleCases().at(ruleCase);
+    RenamePlan plan(rule.mask, rule.rule, rule.strings, rule.numbers);
+    QVERIFY2(plan.isValid(), qPrintable(plan.errorString()));
+    Task task;
+    foreach (const auto& name, names)
+        task.append(name);
+    plan.bind(task);
+    for (qsizetype i = 0; i < names.size(); ++i)
+    {
+        QString modFileName;
+        QVERIFY(plan.apply(names.at(i), i, modFileName));
+        QCOMPARE(modFileName, referenceRename(rule, names.at(i)));
+    }
+}
+
+void FastPathTest::seekUtf16MatchesScalar()
+{
+    // Random mixes of plain units, surrogate pairs, lone surrogates and
+    // combining marks, at every length through the 8 and 16 unit blocks
+    // and past two AVX2 blocks, from every base and offset that lands in
+    // or around the buffer.
+    const char16_t units[] = {u'a', 0xd83d, 0xde00, 0x4e2d, 0x0301, 0xdc00};
+    QRandomGenerator random(5);
+    for (qsizetype size = 0; size <= 40; ++size)
+    {
+        for (int round = 0; round < 8; ++round)
+        {
+            QList<char16_t> text(size);
+            for (auto& unit : text)
+                unit = units[random.bounded(int(std::size(units)))];
+            // A pair straddling each block boundary in the first rounds.
+            if (round < 2 && size > 8)
+            {
+                text[7] = 0xd83d;
+                text[8] = 0xde00;
+            }
+            if (round < 2 && size > 16)
+            {
+                text[15] = 0xd83d;
+                text[16] = 0xde00;
+            }
+            const char16_t* s = text.constData();
+            for (qsizetype base = -3; base <= size + 3; ++base)
+            {
+                for (qsizetype offset = -size - 4; offset <= size + 4; ++offset)
+                {
+                    qsizetype expected = referenceSeek(s, size, base, offset, isLeadUtf16);
+                    qsizetype actual = CodePointIndex::seekUtf16(s, size, base, offset);
+                    if (actual != expected)
+                        QFAIL(qPrintable(QString("size %1, base %2, offset %3: %4 instead of %5").arg(size).arg(base).arg(offset).arg(actual).arg(expected)));
+                }
+            }
+        }
+    }
+}
+
+void FastPathTest::seekUtf8MatchesScalar()
+{
+    // Lead and continuation bytes of every length of sequence, through
+    // the 16 and 32 byte blocks.
+    const char bytes[] = {'a', char(0xc3), char(0xa9), char(0xe4), char(0xb8), char(0xad), char(0xf0), char(0x9f), char(0x98), char(0x80)};
+    QRandomGenerator random(8);
+    for (qsizetype size = 0; size <= 72; ++size)
+    {
+        for (int round = 0; round < 4; ++round)
+        {
+            QByteArray text(size, Qt::Uninitialized);
+            for (auto& byte : text)
+                byte = bytes[random.bounded(int(std::size(bytes)))];
+            const char* s = text.constData();
+            for (qsizetype base = -3; base <= size + 3; ++base)
+            {
+                for (qsizetype offset = -size - 4; offset <= size + 4; ++offset)
+                {
+                    qsizetype expected = referenceSeek(s, size, base, offset, isLeadUtf8);
+                    qsizetype actual = CodePointIndex::seekUtf8(s, size, base, offset);
+                    if (actual != expected)
+                        QFAIL(qPrintable(QString("size %1, base %2, offset %3: %4 instead of %5").arg(size).arg(base).arg(offset).arg(actual).arg(expected)));
+                }
+            }
+        }
+    }
+}
+
+void FastPathTest::untouchedAtEveryPosition()
+{
+    // One unit outside the ranges, a combining mark no form leaves alone,
+    // at each position of names long enough for two AVX2 blocks and a
+    // tail, among ASCII and among ideographs.
+    const QString::NormalizationForm forms[] = {QString::NormalizationForm_D, QString::NormalizationForm_C, QString::NormalizationForm_KD, QString::NormalizationForm_KC};
+    for (QChar filler : {QChar('a'), QChar(0x4e2d)})
+    {
+        for (qsizetype size = 1; size <= 40; ++size)
+        {
+            QString text(size, filler);
+            for (auto form : forms)
+                QVERIFY(UnicodeForm::isUntouched(text, form));
+            for (qsizetype i = 0; i < size; ++i)
+            {
+                text[i] = QChar(0x0301);
+                for (auto form : forms)
+                    QVERIFY2(!UnicodeForm::isUntouched(text, form), qPrintable(QString("size %1, position %2").arg(size).arg(i)));
+                text[i] = filler;
+            }
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(FastPathTest)
+
+#include "fastpathtest.moc"
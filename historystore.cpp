@@ -0,0 +1,413 @@
+#include <QIODevice>
+#include <QtEndian>
+#include <limits>
+#include "historystore.h"
+
+// Layout written by save() and read back by load(), all little-endian:
+// six 64-bit counts (dirs, items, steps, arena units, base steps, base
+// arena units) and a 32-bit fragmented flag padded to 64 bits, then every
+// directory as a 32-bit length and its UTF-16 units, the steps (64-bit
+// offset, 32-bit length and previous), the items (four 32-bit fields) and
+// the arena.
+static constexpr qsizetype headerSize = 7 * 8;
+static constexpr qsizetype stepSize = 16;
+static constexpr qsizetype itemSize = 16;
+static constexpr qsizetype saveBlock = 1 << 20;
+
+HistoryStore::HistoryStore()
+{
+    this->clear();
+}
+
+void HistoryStore::append(QStringView path)
+{
+    qsizetype separator = path.lastIndexOf(QChar('/'));
+    this->append(path.left(separator + 1), path.mid(separator + 1));
+}
+
+void HistoryStore::append(QStringView prefix, QStringView fileName)
+{
+    // Items mostly come grouped by directory, so a prefix is only copied
+    // when it differs from the last one.
+    quint32 dir;
+    if (!this->dirs.isEmpty() && this->dirs.last() == prefix)
+    {
+        dir = quint32(this->dirs.size() - 1);
+    }
+    else
+    {
+        QString key = prefix.toString();
+        QHash<QString, quint32>::const_iterator found = this->dirIndex.constFind(key);
+        if (found == this->dirIndex.cend())
+        {
+            dir = quint32(this->dirs.size());
+            this->dirs.append(key);
+            this->dirIndex.insert(key, dir);
+        }
+        else
+        {
+            dir = found.value();
+        }
+    }
+    // Base steps are kept in front of every derived step so that resetting
+    // all histories is a plain truncation; an append after a preview breaks
+    // that order until the next compaction.
+    if (this->steps.size() != this->baseSteps)
+        this->fragmented = true;
+    Step step;
+    step.offset = this->arena.size();
+    step.length = quint32(fileName.size());
+    step.previous = quint32(this->steps.size());
+    this->arena.append(fileName);
+    Item item;
+    item.dir = dir;
+    item.base = quint32(this->steps.size());
+    item.top = item.base;
+    item.depth = 1;
+    this->steps.append(step);
+    this->items.append(item);
+    if (!this->fragmented)
+    {
+        this->baseSteps = this->steps.size();
+        this->baseArena = this->arena.size();
+    }
+}
+
+void HistoryStore::clear()
+{
+    this->dirs.clear();
+    this->dirIndex.clear();
+    this->arena.clear();
+    this->steps.clear();
+    this->items.clear();
+    this->baseSteps = 0;
+    this->baseArena = 0;
+    this->fragmented = false;
+}
+
+qsizetype HistoryStore::depth(qsizetype item) const
+{
+    return this->items.at(item).depth;
+}
+
+const QString& HistoryStore::dirAt(quint32 dir) const
+{
+    return this->dirs.at(dir);
+}
+
+qsizetype HistoryStore::dirCount() const
+{
+    return this->dirs.size();
+}
+
+quint32 HistoryStore::dirId(qsizetype item) const
+{
+    return this->items.at(item).dir;
+}
+
+QString HistoryStore::dirPath(qsizetype item) const
+{
+    const QString& prefix = this->dirPrefix(item);
+    if (prefix.isEmpty())
+        return QString(QChar('.'));
+    if (prefix.size() == 1 || prefix.endsWith(QStringLiteral(":/")))
+        return prefix;
+    return prefix.chopped(1);
+}
+
+const QString& HistoryStore::dirPrefix(qsizetype item) const
+{
+    return this->dirs.at(this->items.at(item).dir);
+}
+
+QString HistoryStore::fileName(qsizetype item, qsizetype step) const
+{
+    return this->fileNameView(item, step).toString();
+}
+
+QStringView HistoryStore::fileNameView(qsizetype item, qsizetype step) const
+{
+    // The view points into the arena and is invalidated by the next push.
+    const Step& s = this->steps.at(this->stepAt(item, step));
+    return QStringView(this->arena).mid(s.offset, s.length);
+}
+
+QString HistoryStore::filePath(qsizetype item, qsizetype step) const
+{
+    return this->dirPrefix(item) + this->fileNameView(item, step);
+}
+
+bool HistoryStore::isEmpty() const
+{
+    return this->items.isEmpty();
+}
+
+bool HistoryStore::load(const char* data, qsizetype size)
+{
+    // Reads what save() wrote, typically straight from a memory map: the
+    // arena and the tables are copied in bulk, and every index is checked
+    // so that a damaged file is refused rather than trusted.
+    this->clear();
+    const char* end = data + size;
+    auto take = [&data, end](qsizetype bytes) -> const char* {
+        if (bytes < 0 || end - data < bytes)
+            return nullptr;
+        const char* p = data;
+        data += bytes;
+        return p;
+    };
+    const char* header = take(headerSize);
+    if (!header)
+        return false;
+    quint64 counts[6];
+    for (int c = 0; c < 6; ++c)
+        counts[c] = qFromLittleEndian<quint64>(header + c * 8);
+    quint64 dirCount = counts[0];
+    quint64 itemCount = counts[1];
+    quint64 stepCount = counts[2];
+    quint64 arenaSize = counts[3];
+    // Each table must fit in what is left before anything is allocated.
+    if (dirCount > quint64(size) / 4 || itemCount > quint64(size) / itemSize || stepCount > quint64(size) / stepSize
+        || arenaSize > quint64(size) / 2 || stepCount > std::numeric_limits<quint32>::max()
+        || counts[4] > stepCount || counts[5] > arenaSize)
+        return false;
+    this->dirs.reserve(qsizetype(dirCount));
+    for (quint64 d = 0; d < dirCount; ++d)
+    {
+        const char* length = take(4);
+        const char* units = length ? take(qsizetype(qFromLittleEndian<quint32>(length)) * 2) : nullptr;
+        if (!units)
+        {
+            this->clear();
+            return false;
+        }
+        QString dir(qsizetype(qFromLittleEndian<quint32>(length)), Qt::Uninitialized);
+        qFromLittleEndian<quint16>(units, dir.size(), dir.data());
+        this->dirIndex.insert(dir, quint32(this->dirs.size()));
+        this->dirs.append(dir);
+    }
+    const char* steps = take(qsizetype(stepCount) * stepSize);
+    const char* items = take(qsizetype(itemCount) * itemSize);
+    const char* arena = take(qsizetype(arenaSize) * 2);
+    if (!steps || !items || !arena)
+    {
+        this->clear();
+        return false;
+    }
+    this->steps.resize(qsizetype(stepCount));
+    for (qsizetype i = 0; i < this->steps.size(); ++i)
+    {
+        Step& step = this->steps[i];
+        const char* p = steps + i * stepSize;
+        quint64 offset = qFromLittleEndian<quint64>(p);
+        step.length = qFromLittleEndian<quint32>(p + 8);
+        step.previous = qFromLittleEndian<quint32>(p + 12);
+        if (offset > arenaSize || step.length > arenaSize - offset || step.previous >= stepCount
+            || (quint64(i) < counts[4] && offset + step.length > counts[5]))
+        {
+            this->clear();
+            return false;
+        }
+        step.offset = qsizetype(offset);
+    }
+    // A reset truncates to the base steps without compacting unless the
+    // store is fragmented, so every item must then start below them, and
+    // its chain must lead from its top back to its base. Every step is on
+    // at most one chain, which bounds the walks.
+    bool fragmented = qFromLittleEndian<quint32>(header + 48) != 0;
+    quint64 totalDepth = 0;
+    this->items.resize(qsizetype(itemCount));
+    for (qsizetype i = 0; i < this->items.size(); ++i)
+    {
+        Item& item = this->items[i];
+        const char* p = items + i * itemSize;
+        item.dir = qFromLittleEndian<quint32>(p);
+        item.base = qFromLittleEndian<quint32>(p + 4);
+        item.top = qFromLittleEndian<quint32>(p + 8);
+        item.depth = qFromLittleEndian<quint32>(p + 12);
+        totalDepth += item.depth;
+        if (item.dir >= dirCount || item.base >= stepCount || item.top >= stepCount || item.depth < 1
+            || totalDepth > stepCount || (!fragmented && item.base >= counts[4]))
+        {
+            this->clear();
+            return false;
+        }
+        quint32 s = item.top;
+        for (quint32 d = item.depth - 1; d > 0; --d)
+            s = this->steps.at(s).previous;
+        if (s != item.base)
+        {
+            this->clear();
+            return false;
+        }
+    }
+    this->arena.resize(qsizetype(arenaSize));
+    qFromLittleEndian<quint16>(arena, this->arena.size(), this->arena.data());
+    this->baseSteps = qsizetype(counts[4]);
+    this->baseArena = qsizetype(counts[5]);
+    this->fragmented = fragmented;
+    return true;
+}
+
+void HistoryStore::push(qsizetype item, QStringView fileName)
+{
+    Item& i = this->items[item];
+    Step step;
+    step.offset = this->arena.size();
+    step.length = quint32(fileName.size());
+    step.previous = i.top;
+    this->arena.append(fileName);
+    i.top = quint32(this->steps.size());
+    ++i.depth;
+    this->steps.append(step);
+}
+
+void HistoryStore::pushBatch(qsizetype first, const Batch& batch)
+{
+    qsizetype offset = 0;
+    for (qsizetype i = 0; i < batch.lengths.size(); ++i)
+    {
+        qsizetype length = batch.lengths.at(i);
+        if (length >= 0)
+        {
+            this->push(first + i, QStringView(batch.names).mid(offset, length));
+            offset += length;
+        }
+    }
+}
+
+void HistoryStore::resetAll()
+{
+    if (this->fragmented)
+    {
+        this->compact();
+    }
+    else
+    {
+        this->steps.resize(this->baseSteps);
+        this->arena.truncate(this->baseArena);
+        for (QList<Item>::iterator item = this->items.begin(); item < this->items.end(); ++item)
+        {
+            item->top = item->base;
+            item->depth = 1;
+        }
+    }
+}
+
+bool HistoryStore::save(QIODevice& device) const
+{
+    // The tables are encoded into a bounded buffer and written block by
+    // block, so saving millions of items needs no second copy of them.
+    QByteArray buffer;
+    buffer.reserve(saveBlock * 3 + stepSize);
+    auto flush = [&buffer, &device](qsizetype above) {
+        if (buffer.size() <= above)
+            return true;
+        bool written = device.write(buffer) == buffer.size();
+        buffer.resize(0);
+        return written;
+    };
+    auto put64 = [&buffer](quint64 value) {
+        char bytes[8];
+        qToLittleEndian(value, bytes);
+        buffer.append(bytes, 8);
+    };
+    auto put32 = [&buffer](quint32 value) {
+        char bytes[4];
+        qToLittleEndian(value, bytes);
+        buffer.append(bytes, 4);
+    };
+    auto putUnits = [&buffer](QStringView text) {
+        qsizetype at = buffer.size();
+        buffer.resize(at + text.size() * 2);
+        qToLittleEndian<quint16>(text.utf16(), text.size(), buffer.data() + at);
+    };
+    put64(quint64(this->dirs.size()));
+    put64(quint64(this->items.size()));
+    put64(quint64(this->steps.size()));
+    put64(quint64(this->arena.size()));
+    put64(quint64(this->baseSteps));
+    put64(quint64(this->baseArena));
+    put64(this->fragmented ? 1 : 0);
+    foreach (const auto& dir, this->dirs)
+    {
+        put32(quint32(dir.size()));
+        putUnits(dir);
+        if (!flush(saveBlock))
+            return false;
+    }
+    foreach (const auto& step, this->steps)
+    {
+        put64(quint64(step.offset));
+        put32(step.length);
+        put32(step.previous);
+        if (!flush(saveBlock))
+            return false;
+    }
+    foreach (const auto& item, this->items)
+    {
+        put32(item.dir);
+        put32(item.base);
+        put32(item.top);
+        put32(item.depth);
+        if (!flush(saveBlock))
+            return false;
+    }
+    for (qsizetype offset = 0; offset < this->arena.size(); offset += saveBlock)
+    {
+        putUnits(QStringView(this->arena).mid(offset, saveBlock));
+        if (!flush(saveBlock))
+            return false;
+    }
+    return flush(0);
+}
+
+qsizetype HistoryStore::size() const
+{
+    return this->items.size();
+}
+
+void HistoryStore::truncate(qsizetype item, qsizetype depth)
+{
+    Item& i = this->items[item];
+    while (i.depth > 1 && i.depth > depth)
+    {
+        i.top = this->steps.at(i.top).previous;
+        --i.depth;
+    }
+}
+
+void HistoryStore::compact()
+{
+    QString arena;
+    QList<Step> steps;
+    arena.reserve(this->arena.size());
+    steps.reserve(this->items.size());
+    for (QList<Item>::iterator item = this->items.begin(); item < this->items.end(); ++item)
+    {
+        const Step& base = this->steps.at(item->base);
+        Step step;
+        step.offset = arena.size();
+        step.length = base.length;
+        step.previous = quint32(steps.size());
+        arena.append(QStringView(this->arena).mid(base.offset, base.length));
+        item->base = quint32(steps.size());
+        item->top = item->base;
+        item->depth = 1;
+        steps.append(step);
+    }
+    this->arena = arena;
+    this->steps = steps;
+    this->baseSteps = this->steps.size();
+    this->baseArena = this->arena.size();
+    this->fragmented = false;
+}
+
+quint32 HistoryStore::stepAt(qsizetype item, qsizetype step) const
+{
+    const Item& i = this->items.at(item);
+    quint32 s = i.top;
+    for (qsizetype d = i.depth - 1; d > step; --d)
+        s = this->steps.at(s).previous;
+    return s;
+}
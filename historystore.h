@@ -0,0 +1,72 @@
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+class QIODevice;
+
+// Rename histories of a task, stored without repeating directories.
+// Every item lives in one interned directory; each history step only
+// keeps the basename, packed into a shared arena and chained to the
+// previous step of the same item.
+class HistoryStore
+{
+public:
+    // Basenames computed off-store (e.g. by a worker thread) for a run of
+    // consecutive items. A negative length means the item gets no new step.
+    struct Batch
+    {
+        QString names;
+        QList<qsizetype> lengths;
+    };
+    HistoryStore();
+    void append(QStringView);
+    void append(QStringView, QStringView);
+    void clear();
+    qsizetype depth(qsizetype) const;
+    const QString& dirAt(quint32) const;
+    qsizetype dirCount() const;
+    quint32 dirId(qsizetype) const;
+    QString dirPath(qsizetype) const;
+    const QString& dirPrefix(qsizetype) const;
+    QString fileName(qsizetype, qsizetype) const;
+    QStringView fileNameView(qsizetype, qsizetype) const;
+    QString filePath(qsizetype, qsizetype) const;
+    bool isEmpty() const;
+    bool load(const char*, qsizetype);
+    void push(qsizetype, QStringView);
+    void pushBatch(qsizetype, const Batch&);
+    void resetAll();
+    bool save(QIODevice&) const;
+    qsizetype size() const;
+    void truncate(qsizetype, qsizetype);
+
+private:
+    struct Step
+    {
+        qsizetype offset;
+        quint32 length;
+        quint32 previous;
+    };
+    struct Item
+    {
+        quint32 dir;
+        quint32 base;
+        quint32 top;
+        quint32 depth;
+    };
+    QList<QString> dirs;
+    QHash<QString, quint32> dirIndex;
+    QString arena;
+    QList<Step> steps;
+    QList<Item> items;
+    qsizetype baseSteps;
+    qsizetype baseArena;
+    bool fragmented;
+    void compact();
+    quint32 stepAt(qsizetype, qsizetype) const;
+};
+
+#endif // HISTORYSTORE_H
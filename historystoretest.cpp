@@ -0,0 +1,137 @@
+#include <QBuffer>
+#include <QtEndian>
+#include <QtTest>
+#include "historystore.h"
+
+// Saves histories and loads them back, and feeds load() plans that were
+// cut short or tampered with, which it has to refuse.
+
+// One directory and two items, the first renamed once: three steps, two
+// of them base steps in the first ten arena units. Saved, that is the
+// header at 0, the directory at 56, the steps at 66, the items at 114
+// and the arena at 146.
+static constexpr int stepsAt = 66;
+static constexpr int itemsAt = 114;
+
+static HistoryStore smallStore()
+{
+    HistoryStore store;
+    store.append(u"/a/x.txt");
+    store.append(u"/a/y.txt");
+    store.push(0, u"z.txt");
+    return store;
+}
+
+static QByteArray saved(const HistoryStore& store)
+{
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    store.save(buffer);
+    return data;
+}
+
+static void compareStores(const HistoryStore& loaded, const HistoryStore& store)
+{
+    QCOMPARE(loaded.size(), store.size());
+    QCOMPARE(loaded.dirCount(), store.dirCount());
+    for (qsizetype i = 0; i < store.size(); ++i)
+    {
+        QCOMPARE(loaded.depth(i), store.depth(i));
+        for (qsizetype step = 0; step < store.depth(i); ++step)
+            QCOMPARE(loaded.filePath(i, step), store.filePath(i, step));
+    }
+}
+
+class HistoryStoreTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void refusesTampered_data();
+    void refusesTampered();
+    void refusesTruncated();
+    void roundTrip();
+    void roundTripFragmented();
+};
+
+void HistoryStoreTest::refusesTampered_data()
+{
+    QTest::addColumn<QList<int>>("at");
+    QTest::addColumn<quint32>("value");
+    QTest::newRow("baseStepsPastSteps") << QList<int>{32} << quint32(4);
+    QTest::newRow("baseArenaPastArena") << QList<int>{40} << quint32(16);
+    QTest::newRow("dirPastDirs") << QList<int>{itemsAt + 16} << quint32(1);
+    QTest::newRow("offsetPastArena") << QList<int>{stepsAt} << quint32(14);
+    QTest::newRow("baseStepPastBaseArena") << QList<int>{stepsAt + 16} << quint32(10);
+    QTest::newRow("previousPastSteps") << QList<int>{stepsAt + 32 + 12} << quint32(3);
+    QTest::newRow("baseOutsideBaseSteps") << QList<int>{itemsAt + 16 + 4, itemsAt + 16 + 8} << quint32(2);
+    QTest::newRow("topPastSteps") << QList<int>{itemsAt + 8} << quint32(3);
+    QTest::newRow("chainMissesBase") << QList<int>{itemsAt + 12} << quint32(1);
+    QTest::newRow("noDepth") << QList<int>{itemsAt + 16 + 12} << quint32(0);
+    QTest::newRow("depthPastSteps") << QList<int>{itemsAt + 16 + 12} << quint32(3);
+}
+
+void HistoryStoreTest::refusesTampered()
+{
+    QFETCH(QList<int>, at);
+    QFETCH(quint32, value);
+    QByteArray data = saved(smallStore());
+    HistoryStore loaded;
+    QVERIFY(loaded.load(data.constData(), data.size()));
+    foreach (int field, at)
+        qToLittleEndian(value, data.data() + field);
+    QVERIFY(!loaded.load(data.constData(), data.size()));
+    QVERIFY(loaded.isEmpty());
+}
+
+void HistoryStoreTest::refusesTruncated()
+{
+    QByteArray data = saved(smallStore());
+    for (qsizetype size = 0; size < data.size(); ++size)
+    {
+        HistoryStore loaded;
+        QVERIFY2(!loaded.load(data.constData(), size), qPrintable(QString("size %1").arg(size)));
+    }
+}
+
+void HistoryStoreTest::roundTrip()
+{
+    HistoryStore store;
+    store.append(u"/a/x.txt");
+    store.append(u"/a/y.txt");
+    store.append(u"/b/w.txt");
+    store.push(0, u"z.txt");
+    store.push(2, u"v.txt");
+    store.push(2, u"u.txt");
+    store.truncate(0, 1);
+    QByteArray data = saved(store);
+    HistoryStore loaded;
+    QVERIFY(loaded.load(data.constData(), data.size()));
+    compareStores(loaded, store);
+    loaded.resetAll();
+    store.resetAll();
+    compareStores(loaded, store);
+    QCOMPARE(loaded.filePath(2, 0), QStringLiteral("/b/w.txt"));
+}
+
+void HistoryStoreTest::roundTripFragmented()
+{
+    // An item appended after a rename lies behind a derived step, so a
+    // reset has to compact the loaded store instead of truncating it.
+    HistoryStore store = smallStore();
+    store.append(u"/a/w.txt");
+    QByteArray data = saved(store);
+    HistoryStore loaded;
+    QVERIFY(loaded.load(data.constData(), data.size()));
+    compareStores(loaded, store);
+    loaded.resetAll();
+    store.resetAll();
+    compareStores(loaded, store);
+    loaded.push(2, u"v.txt");
+    QCOMPARE(loaded.filePath(2, 1), QStringLiteral("/a/v.txt"));
+}
+
+QTEST_GUILESS_MAIN(HistoryStoreTest)
+
+#include "historystoretest.moc"
@@ -1,12 +1,31 @@
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
 #include <QDragEnterEvent>
+#include <QFileDialog>
 #include <QFileInfo>
+#include <QHeaderView>
+#include <QMenu>
+#include <QMessageBox>
 #include <QMimeData>
+#include <QTimer>
+#include "codepage.h"
+#include "renameplan.h"
+#include "taskfile.h"
+#include "trace.h"
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
+    , taskModel(new TaskModel(this))
+    , renameJob(nullptr)
+    , directoryScanner(nullptr)
+    , previewJob(nullptr)
+    , previewTimer(new QTimer(this))
+    , directorySnapshot(new DirectorySnapshot)
+    , resolution(Task::ReportCollisions)
+    , hasCompletedJournal(!RenameJournal::completed().isEmpty())
+    , detectedRule(Task::ToUnicode)
+    , detectedRows(-1)
 {
     ui->setupUi(this);
     this->setWindowFlags(Qt::Window | Qt::MSWindowsFixedSizeDialogHint | Qt::WindowStaysOnTopHint);
@@ -21,6 +40,9 @@ MainWindow::MainWindow(QWidget *parent)
     ui->spinBox_Digits->setMaximum(maxOrdinalDigits);
     ui->lineEdit_Ordinal->setValidator(new QRegularExpressionValidator(QRegularExpression("[0-9]*"), ui->lineEdit_Ordinal));
     ui->spinBox_Digits->setValue(3);
+    this->connect(ui->comboBox_Order, &QComboBox::currentIndexChanged, this, &MainWindow::switchToOrder);
+    ui->comboBox_Order->setCurrentIndex(RenamePlan::DropOrder);
+    this->switchToOrder(ui->comboBox_Order->currentIndex());
     this->connect(ui->radioButton_Delete, &QRadioButton::toggled, this, &MainWindow::switchToDelete);
     this->connect(ui->radioButton_Insert, &QRadioButton::toggled, this, &MainWindow::switchToInsert);
     this->switchToDelete(ui->radioButton_Delete->isChecked());
@@ -34,12 +56,56 @@ MainWindow::MainWindow(QWidget *parent)
     this->connect(ui->pushButton_RenameExtExcluded, &QPushButton::clicked, this, &MainWindow::renameExtExcluded);
     this->connect(ui->pushButton_RenameExtOnly, &QPushButton::clicked, this, &MainWindow::renameExtOnly);
     ui->checkBox_Test->setChecked(true);
-    ui->textBrowser_TaskView->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
-    ui->textBrowser_TaskView->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
-    ui->textBrowser_TaskView->setLineWrapMode(QTextEdit::NoWrap);
+    this->connect(ui->checkBox_Recursive, &QCheckBox::toggled, this, &MainWindow::switchToRecursive);
+    this->switchToRecursive(ui->checkBox_Recursive->isChecked());
+    ui->spinBox_Depth->setValue(0);
+    ui->comboBox_EntryType->setCurrentIndex(DirectoryScanner::FilesAndDirs);
+    QMenu* chainMenu = new QMenu(ui->pushButton_ChainAdd);
+    this->connect(chainMenu->addAction(ui->pushButton_RenameExtExcluded->text()), &QAction::triggered, this, &MainWindow::chainExtExcluded);
+    this->connect(chainMenu->addAction(ui->pushButton_RenameExtOnly->text()), &QAction::triggered, this, &MainWindow::chainExtOnly);
+    ui->pushButton_ChainAdd->setMenu(chainMenu);
+    this->connect(ui->pushButton_ChainClear, &QPushButton::clicked, this, &MainWindow::clearChain);
+    this->updateChainLabel();
+    this->connect(ui->pushButton_Cancel, &QPushButton::clicked, this, &MainWindow::cancelWork);
+    this->connect(ui->pushButton_Undo, &QPushButton::clicked, this, &MainWindow::undoLastRun);
+    ui->pushButton_Cancel->setVisible(false);
+    ui->progressBar_Run->setVisible(false);
+    ui->tableView_TaskView->setModel(this->taskModel);
+    ui->tableView_TaskView->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
+    ui->tableView_TaskView->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
+    ui->tableView_TaskView->setWordWrap(false);
+    ui->tableView_TaskView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    ui->tableView_TaskView->verticalHeader()->setDefaultSectionSize(ui->tableView_TaskView->fontMetrics().height() + 4);
+    ui->tableView_TaskView->horizontalHeader()->setSectionResizeMode(QHeaderView::Interactive);
+    ui->tableView_TaskView->horizontalHeader()->setStretchLastSection(true);
+    ui->tableView_TaskView->setContextMenuPolicy(Qt::CustomContextMenu);
+    this->connect(ui->tableView_TaskView, &QTableView::customContextMenuRequested, this, &MainWindow::showTaskMenu);
+    this->previewTimer->setSingleShot(true);
+    this->previewTimer->setInterval(MainWindow::previewDelay);
+    this->connect(this->previewTimer, &QTimer::timeout, this, &MainWindow::startPreview);
+    this->connect(ui->tabWidget_Rules, &QTabWidget::currentChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->lineEdit_RenameTo, &QLineEdit::textChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->lineEdit_Prefix, &QLineEdit::textChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->lineEdit_Ordinal, &QLineEdit::textChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->checkBox_Reverse, &QCheckBox::toggled, this, &MainWindow::schedulePreview);
+    this->connect(ui->comboBox_Order, &QComboBox::currentIndexChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->lineEdit_ReplaceFrom, &QLineEdit::textChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->lineEdit_ReplaceTo, &QLineEdit::textChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->checkBox_Regex, &QCheckBox::toggled, this, &MainWindow::schedulePreview);
+    this->connect(ui->checkBox_CaseInsensitive, &QCheckBox::toggled, this, &MainWindow::schedulePreview);
+    this->connect(ui->radioButton_Insert, &QRadioButton::toggled, this, &MainWindow::schedulePreview);
+    this->connect(ui->radioButton_Head, &QRadioButton::toggled, this, &MainWindow::schedulePreview);
+    this->connect(ui->lineEdit_Insert, &QLineEdit::textChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->spinBox_Delete, &QSpinBox::valueChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->spinBox_Indexof, &QSpinBox::valueChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->radioButton_ToUnicode, &QRadioButton::toggled, this, &MainWindow::schedulePreview);
+    this->connect(ui->comboBox_Locale, &QComboBox::currentIndexChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->lineEdit_Template, &QLineEdit::textChanged, this, &MainWindow::schedulePreview);
+    this->connect(ui->comboBox_Form, &QComboBox::currentIndexChanged, this, &MainWindow::schedulePreview);
     this->newTask();
     this->enableRunOrNot();
     this->setTaskView();
+    QTimer::singleShot(0, this, &MainWindow::recoverJournal);
 }
 
 MainWindow::~MainWindow()
@@ -57,31 +123,81 @@ bool MainWindow::hasLocalFileInUrls(const QList<QUrl>& urls)
 
 void MainWindow::dragEnterEvent(QDragEnterEvent* event)
 {
-    if (this->hasLocalFileInUrls(event->mimeData()->urls()))
+    if (!this->isBusy() && this->hasLocalFileInUrls(event->mimeData()->urls()))
         event->acceptProposedAction();
 }
 
 void MainWindow::dropEvent(QDropEvent* event)
 {
+    Trace::Span span("dropEvent");
     this->newTask();
     const QList<QUrl>& urls = event->mimeData()->urls();
+    QStringList paths;
     foreach (const auto& u, urls)
         if (u.isLocalFile())
-            this->taskHistory.top().append(u.toLocalFile());
-    this->enableRunOrNot();
-    this->setTaskView();
+            paths.append(u.toLocalFile());
+    if (ui->checkBox_Recursive->isChecked())
+    {
+        this->startDirectoryScan(paths);
+    }
+    else
+    {
+        foreach (const auto& path, paths)
+            this->taskHistory.top().append(path);
+        this->enableRunOrNot();
+        this->setTaskView();
+        this->schedulePreview();
+    }
     event->acceptProposedAction();
 }
 
+QString MainWindow::detectCodePage(Task::Rule rule)
+{
+    // Detection reads every name, so its answer is kept until the task
+    // grows or is replaced, or the direction changes.
+    const Task& task = this->taskHistory.top();
+    if (this->detectedRows != task.size() || this->detectedRule != rule)
+    {
+        this->detectedCodePage = CodePage::detect(task, rule);
+        this->detectedRows = task.size();
+        this->detectedRule = rule;
+        if (this->detectedCodePage.isEmpty())
+            ui->comboBox_Locale->setToolTip(tr("沒有可供判斷的非 ASCII 檔名"));
+        else
+            ui->comboBox_Locale->setToolTip(tr("偵測結果：%1").arg(this->detectedCodePage));
+    }
+    return this->detectedCodePage;
+}
+
+bool MainWindow::isBusy() const
+{
+    return this->renameJob || this->directoryScanner;
+}
+
 void MainWindow::newTask()
 {
+    this->stopPreview();
+    this->detectedRows = -1;
+    ui->comboBox_Locale->setToolTip(QString());
+    this->taskModel->setTask(nullptr);
+    this->directorySnapshot.reset(new DirectorySnapshot);
     this->taskHistory.clear();
     this->taskHistory.push(Task());
 }
 
-void MainWindow::rename(Task::Mask mask)
+RenamePlan MainWindow::makePlan(Task::Mask mask)
+{
+    // The chained rules come first and the one being edited last; all of
+    // them are applied in one pass, so each item is renamed only once.
+    if (this->chain.size() == 0)
+        return this->makeRule(mask);
+    RenamePlan plan = this->chain;
+    plan.append(this->makeRule(mask));
+    return plan;
+}
+
+RenamePlan MainWindow::makeRule(Task::Mask mask)
 {
-    this->enableRun(false);
     Task::Rule rule;
     QList<QString> strings;
     QList<int> numbers;
@@ -98,11 +214,21 @@ void MainWindow::rename(Task::Mask mask)
                 rule = Task::OrdinalWithPrefix;
             strings.append(ui->lineEdit_Prefix->text());
             strings.append(ui->lineEdit_Ordinal->text());
+            // The combobox lists the orders as RenamePlan::Order does.
+            numbers.append(ui->comboBox_Order->currentIndex());
         break;
         case 2:
+        {
             rule = Task::Replace;
             strings.append(ui->lineEdit_ReplaceFrom->text());
             strings.append(ui->lineEdit_ReplaceTo->text());
+            int flags = 0;
+            if (ui->checkBox_Regex->isChecked())
+                flags |= RenamePlan::RegularExpression;
+            if (ui->checkBox_CaseInsensitive->isChecked())
+                flags |= RenamePlan::CaseInsensitive;
+            numbers.append(flags);
+        }
         break;
         case 3:
             if (ui->radioButton_Insert->isChecked())
@@ -118,8 +244,7 @@ void MainWindow::rename(Task::Mask mask)
                 else
                 {
                     qWarning() << "Neither head nor tail specified.";
-                    this->enableRunOrNot();
-                    return;
+                    return RenamePlan();
                 }
                 numbers.append(ui->spinBox_Indexof->value() - 1);
                 strings.append(ui->lineEdit_Insert->text());
@@ -137,8 +262,7 @@ void MainWindow::rename(Task::Mask mask)
                 else
                 {
                     qWarning() << "Neither head nor tail specified.";
-                    this->enableRunOrNot();
-                    return;
+                    return RenamePlan();
                 }
                 numbers.append(ui->spinBox_Indexof->value() - 1);
                 numbers.append(ui->spinBox_Delete->value());
@@ -146,11 +270,11 @@ void MainWindow::rename(Task::Mask mask)
             else
             {
                 qWarning() << "Neither insert nor delete specified.";
-                this->enableRunOrNot();
-                return;
+                return RenamePlan();
             }
         break;
         case 4:
+        {
             if (ui->radioButton_ToUnicode->isChecked())
             {
                 rule = Task::ToUnicode;
@@ -162,41 +286,206 @@ void MainWindow::rename(Task::Mask mask)
             else
             {
                 qWarning() << "Neither Unicode nor locale specified.";
-                this->enableRunOrNot();
-                return;
+                return RenamePlan();
             }
-            switch (ui->comboBox_Locale->currentIndex())
+            // No code page chosen yet is not an error, just nothing to do;
+            // neither is a batch with nothing to detect from.
+            int localeIndex = ui->comboBox_Locale->currentIndex();
+            if (localeIndex < 0)
+                return RenamePlan();
+            if (localeIndex == 0)
             {
-                case 0:
-                    strings.append("Shift-JIS");
-                break;
-                case 1:
-                    strings.append("GBK");
-                break;
-                case 2:
-                    strings.append("CP949");
-                break;
-                case 3:
-                    strings.append("Big5");
-                break;
-                case 4:
-                    strings.append("Windows-1252");
-                break;
-                default:
-                    qWarning() << "Outbound combobox at " << ui->comboBox_Locale->currentIndex();
-                    this->enableRunOrNot();
-                return;
+                QString codePage = this->detectCodePage(rule);
+                if (codePage.isEmpty())
+                    return RenamePlan();
+                strings.append(codePage);
             }
+            else if (localeIndex <= CodePage::names().size())
+            {
+                strings.append(CodePage::names().at(localeIndex - 1));
+            }
+            else
+            {
+                qWarning() << "Outbound combobox at " << localeIndex;
+                return RenamePlan();
+            }
+        }
+        break;
+        case 5:
+            rule = Task::Template;
+            strings.append(ui->lineEdit_Template->text());
+        break;
+        case 6:
+        {
+            // Same order as the items of comboBox_Form.
+            static const QString::NormalizationForm forms[] = {QString::NormalizationForm_C, QString::NormalizationForm_D, QString::NormalizationForm_KC, QString::NormalizationForm_KD};
+            static const UnicodeForm::Case cases[] = {UnicodeForm::UpperCase, UnicodeForm::LowerCase, UnicodeForm::TitleCase};
+            int formIndex = ui->comboBox_Form->currentIndex();
+            if (formIndex >= 0 && formIndex < 4)
+            {
+                rule = Task::Normalize;
+                numbers.append(forms[formIndex]);
+            }
+            else if (formIndex >= 4 && formIndex < 7)
+            {
+                rule = Task::ChangeCase;
+                numbers.append(cases[formIndex - 4]);
+            }
+            else
+            {
+                qWarning() << "Outbound combobox at " << formIndex;
+                return RenamePlan();
+            }
+        }
         break;
         default:
             qWarning() << "Outbound tab widget at " << ui->tabWidget_Rules->currentIndex();
-            this->enableRunOrNot();
+        return RenamePlan();
+    }
+    return RenamePlan(mask, rule, strings, numbers);
+}
+
+void MainWindow::rename(Task::Mask mask)
+{
+    this->enableRun(false);
+    this->stopPreview();
+    RenamePlan plan = this->makePlan(mask);
+    if (!plan.isValid())
+    {
+        QMessageBox::warning(this, tr("無法改名"), plan.errorString());
+        this->enableRunOrNot();
         return;
     }
     if (ui->checkBox_Test->isChecked())
-        this->taskHistory.top().renameTestAll(mask, rule, strings, numbers);
+    {
+        // A test run is checked whichever way collisions are handled, so
+        // the names a real run would trip over are marked beforehand.
+        QList<qsizetype> collisions;
+        if (this->taskHistory.top().renameTestAll(plan))
+            collisions = this->taskHistory.top().preflight(this->resolution);
+        Trace::summarize("test");
+        this->finishRename();
+        this->taskModel->setCollisions(collisions, this->resolution);
+    }
     else
-        this->taskHistory.top().renameAll(mask, rule, strings, numbers);
+    {
+        RenameJob* job = new RenameJob(this->taskHistory.top(), plan, this);
+        job->setResolution(this->resolution);
+        this->startRenameJob(job);
+    }
+}
+
+void MainWindow::chainRule(Task::Mask mask)
+{
+    RenamePlan rule = this->makeRule(mask);
+    if (!rule.isValid())
+    {
+        QMessageBox::warning(this, tr("無法串接"), rule.errorString());
+        return;
+    }
+    this->chain.append(rule);
+    QString name = ui->tabWidget_Rules->tabText(ui->tabWidget_Rules->currentIndex()).remove('&');
+    if (mask == Task::ExtOnly)
+        name += tr("（副檔名）");
+    this->chainNames.append(name);
+    this->updateChainLabel();
+    this->schedulePreview();
+}
+
+void MainWindow::replayJournal(const QString& journal, RenameJournal::Recovery recovery)
+{
+    QStringList unresolved;
+    Task task = RenameJournal::recover(journal, recovery, &unresolved);
+    if (!unresolved.isEmpty())
+    {
+        // Guessing could move a file onto another one; the user is told
+        // which files to check by hand instead.
+        QMessageBox box(QMessageBox::Warning, tr("無法確定檔案位置"), tr("以下 %1 個檔案無法確定是否已改名，不會被移動，請手動檢查。").arg(unresolved.size()), QMessageBox::Ok, this);
+        box.setDetailedText(unresolved.join('\n'));
+        box.exec();
+    }
+    if (task.isEmpty())
+    {
+        // Nothing is left to move; the journal has served its purpose.
+        QFile::remove(journal);
+        this->hasCompletedJournal = !RenameJournal::completed().isEmpty();
+        this->enableRunOrNot();
+        return;
+    }
+    this->newTask();
+    this->taskHistory.top() = task;
+    this->setTaskView();
+    this->replayedJournal = journal;
+    this->startRenameJob(new RenameJob(this->taskHistory.top(), this));
+}
+
+void MainWindow::cancelPreviewJob()
+{
+    // A stale job is only told to stop; it deletes itself once its
+    // worker has returned, so the GUI thread never waits for it.
+    if (!this->previewJob)
+        return;
+    this->previewJob->disconnect(this);
+    this->connect(this->previewJob, &PreviewJob::finished, this->previewJob, &QObject::deleteLater);
+    this->previewJob->cancel();
+    this->previewJob = nullptr;
+}
+
+void MainWindow::stopPreview()
+{
+    this->previewTimer->stop();
+    this->cancelPreviewJob();
+    this->taskModel->clearPreview();
+}
+
+void MainWindow::startDirectoryScan(const QStringList& paths)
+{
+    DirectoryScanner::EntryType entryType;
+    switch (ui->comboBox_EntryType->currentIndex())
+    {
+        case 1:
+            entryType = DirectoryScanner::FilesOnly;
+        break;
+        case 2:
+            entryType = DirectoryScanner::DirsOnly;
+        break;
+        default:
+            entryType = DirectoryScanner::FilesAndDirs;
+        break;
+    }
+    this->directoryScanner = new DirectoryScanner(paths, ui->spinBox_Depth->value(), entryType, this);
+    this->connect(this->directoryScanner, &DirectoryScanner::entriesReady, this, &MainWindow::appendScannedEntries);
+    this->connect(this->directoryScanner, &DirectoryScanner::finished, this, &MainWindow::collectDirectoryScanner);
+    this->enableRun(false);
+    ui->label_TaskView->setVisible(false);
+    ui->progressBar_Run->setRange(0, 1);
+    ui->progressBar_Run->setValue(0);
+    ui->progressBar_Run->setFormat(tr("已加入 %1 個項目").arg(0));
+    ui->progressBar_Run->setVisible(true);
+    ui->pushButton_Cancel->setEnabled(true);
+    ui->pushButton_Cancel->setVisible(true);
+    // The model watches the task, so rows show up as they are scanned.
+    this->taskModel->setTask(&this->taskHistory.top());
+    this->directoryScanner->start();
+}
+
+void MainWindow::startRenameJob(RenameJob* job)
+{
+    this->renameJob = job;
+    this->connect(this->renameJob, &RenameJob::progressChanged, this, &MainWindow::showRenameProgress);
+    this->connect(this->renameJob, &RenameJob::finished, this, &MainWindow::collectRenameJob);
+    this->enableRun(false);
+    ui->label_TaskView->setVisible(false);
+    ui->progressBar_Run->setValue(0);
+    ui->progressBar_Run->resetFormat();
+    ui->progressBar_Run->setVisible(true);
+    ui->pushButton_Cancel->setEnabled(true);
+    ui->pushButton_Cancel->setVisible(true);
+    this->renameJob->start();
+}
+
+void MainWindow::finishRename()
+{
     if (ui->checkBox_RunThenClose->isChecked())
     {
         this->close();
@@ -208,14 +497,29 @@ void MainWindow::rename(Task::Mask mask)
     }
 }
 
+void MainWindow::updateChainLabel()
+{
+    if (this->chainNames.isEmpty())
+    {
+        ui->label_Chain->setText(tr("未串接其他規則"));
+        ui->label_Chain->setToolTip(QString());
+        ui->pushButton_ChainClear->setEnabled(false);
+        return;
+    }
+    ui->label_Chain->setText(tr("先套用 %1 條串接規則").arg(this->chainNames.size()));
+    ui->label_Chain->setToolTip(this->chainNames.join("　→　") + tr("　→　目前的規則"));
+    ui->pushButton_ChainClear->setEnabled(true);
+}
+
 void MainWindow::setTaskView()
 {
+    Trace::Span span("setTaskView");
     QString text;
     if (this->taskHistory.isEmpty())
     {
         text = tr("目前沒有任何項目。");
-        text += "\n\n";
         text += tr("請先從桌面或資料夾，拖曳檔案或目錄到此處。");
+        this->taskModel->setTask(nullptr);
     }
     else
     {
@@ -223,69 +527,42 @@ void MainWindow::setTaskView()
         {
             case Task::Ready:
                 text = tr("目前沒有任何項目。");
-                text += "\n\n";
                 text += tr("請先從桌面或資料夾，拖曳檔案或目錄到此處。");
             break;
             case Task::Pending:
                 text = tr("%1 個項目待處理").arg(QString::number(this->taskHistory.top().size()));
-                text += "\n\n";
-                /*
-                {
-                    Task::Filelist::const_iterator file = this->taskHistory.top().cbegin();
-                    while (file < this->taskHistory.top().cend())
-                    {
-                        text += file.value().first() + "\n";
-                        ++file;
-                    }
-                }
-                */
-                foreach (const auto& history, this->taskHistory.top().getFilelist())
-                    text += history.first() + "\n";
             break;
             case Task::Tested:
+                text = tr("測試 %1 個項目").arg(QString::number(this->taskHistory.top().size()));
+            break;
             case Task::Finished:
-                foreach (const auto& history, this->taskHistory.top().getFilelist())
-                {
-                    if (!history.isEmpty())
-                    {
-                        switch (this->taskHistory.top().getStatus())
-                        {
-                            case Task::Tested:
-                                text += tr("測試");
-                            break;
-                            case Task::Finished:
-                                text += tr("改名");
-                            break;
-                            default:
-                                qWarning() << "Status makes no sense.";
-                            return;
-                        }
-                        text += "　";
-                        if (Task::isAllInOneDir(history))
-                        {
-                            text += QFileInfo(history.first()).fileName();
-                            for (int i = 1; i < history.size(); ++i)
-                                text += "　→　" + QFileInfo(history.at(i)).fileName();
-                            text += "　";
-                            text += tr("在目錄");
-                            text += ": " + QFileInfo(history.first()).path();
-                        }
-                        else
-                        {
-                            text += history.first();
-                            for (int i = 1; i < history.size(); ++i)
-                                text += "　→　" + history.at(i);
-                        }
-                    }
-                    text += "\n";
-                }
+                text = tr("改名 %1 個項目").arg(QString::number(this->taskHistory.top().size()));
             break;
             default:
                 qWarning() << "No such task status: " << this->taskHistory.top().getStatus();
             return;
         }
+        this->taskModel->setTask(&this->taskHistory.top());
     }
-    ui->textBrowser_TaskView->setPlainText(text);
+    ui->label_TaskView->setText(text);
+}
+
+void MainWindow::appendScannedEntries()
+{
+    if (!this->directoryScanner)
+        return;
+    foreach (const auto& entries, this->directoryScanner->takeEntries())
+        this->taskHistory.top().append(entries.dirPrefix, entries.fileNames);
+    ui->progressBar_Run->setFormat(tr("已加入 %1 個項目").arg(this->taskHistory.top().size()));
+}
+
+void MainWindow::cancelWork()
+{
+    if (this->renameJob)
+        this->renameJob->cancel();
+    if (this->directoryScanner)
+        this->directoryScanner->cancel();
+    ui->pushButton_Cancel->setEnabled(false);
 }
 
 void MainWindow::changeDigitsByOrdinal(const QString& text)
@@ -318,9 +595,86 @@ void MainWindow::changeOrdinalByDigits(int i)
     }
 }
 
+void MainWindow::chainExtExcluded()
+{
+    this->chainRule(Task::ExtExcluded);
+}
+
+void MainWindow::chainExtOnly()
+{
+    this->chainRule(Task::ExtOnly);
+}
+
+void MainWindow::clearChain()
+{
+    this->chain = RenamePlan();
+    this->chainNames.clear();
+    this->updateChainLabel();
+    this->schedulePreview();
+}
+
+void MainWindow::collectDirectoryScanner()
+{
+    this->appendScannedEntries();
+    bool canceled = this->directoryScanner->isCanceled();
+    this->directoryScanner->deleteLater();
+    this->directoryScanner = nullptr;
+    ui->progressBar_Run->setVisible(false);
+    ui->pushButton_Cancel->setVisible(false);
+    ui->label_TaskView->setVisible(true);
+    this->enableRunOrNot();
+    this->setTaskView();
+    Trace::summarize("scan");
+    if (canceled)
+        ui->label_TaskView->setText(ui->label_TaskView->text() + tr("（已取消）"));
+    this->schedulePreview();
+}
+
+void MainWindow::collectPreviewJob()
+{
+    this->showPreview();
+    if (!this->previewJob->isCanceled())
+    {
+        Trace::summarize("preview");
+        this->taskModel->setCollisions(this->previewJob->collisions(), this->resolution);
+    }
+    this->previewJob->deleteLater();
+    this->previewJob = nullptr;
+}
+
+void MainWindow::collectRenameJob()
+{
+    bool canceled = this->renameJob->isCanceled();
+    bool replayed = !this->replayedJournal.isEmpty();
+    QString error = this->renameJob->errorString();
+    if (replayed && !canceled && error.isEmpty() && !this->renameJob->failures())
+        QFile::remove(this->replayedJournal);
+    this->replayedJournal.clear();
+    // Journals only come and go with runs, so they are listed once per run
+    // rather than whenever the buttons are updated.
+    this->hasCompletedJournal = !RenameJournal::completed().isEmpty();
+    this->taskHistory.top() = this->renameJob->result();
+    // Directories read for earlier previews no longer hold what they did.
+    this->directorySnapshot.reset(new DirectorySnapshot);
+    this->renameJob->deleteLater();
+    this->renameJob = nullptr;
+    ui->progressBar_Run->setVisible(false);
+    ui->pushButton_Cancel->setVisible(false);
+    ui->label_TaskView->setVisible(true);
+    Trace::summarize("rename");
+    this->finishRename();
+    if (canceled)
+        ui->label_TaskView->setText(ui->label_TaskView->text() + tr("（已取消）"));
+    if (!error.isEmpty())
+        QMessageBox::warning(this, tr("無法改名"), error);
+    else if (replayed)
+        this->recoverJournal();
+}
+
 void MainWindow::enableRun(bool enabled)
 {
-    if (!enabled || this->taskHistory.isEmpty())
+    ui->pushButton_Undo->setEnabled(enabled && !this->isBusy() && this->hasCompletedJournal);
+    if (!enabled || this->taskHistory.isEmpty() || this->isBusy())
     {
         ui->pushButton_RenameExtExcluded->setEnabled(false);
         ui->pushButton_RenameExtOnly->setEnabled(false);
@@ -365,6 +719,59 @@ void MainWindow::enableRunOrNot()
     this->enableRun(true);
 }
 
+void MainWindow::openTaskFile()
+{
+    if (this->isBusy())
+        return;
+    QString fileName = QFileDialog::getOpenFileName(this, tr("開啟路徑清單或改名計畫"), QString(), tr("改名計畫 (*.koiplan);;以 NUL 分隔的路徑清單 (*)"));
+    if (fileName.isEmpty())
+        return;
+    Task task;
+    TaskFile file(fileName);
+    if (!file.read(task))
+    {
+        QMessageBox::warning(this, tr("無法開啟"), file.errorString());
+        return;
+    }
+    this->newTask();
+    this->taskHistory.top() = task;
+    this->enableRunOrNot();
+    this->setTaskView();
+    if (file.format() != TaskFile::Plan || task.getStatus() != Task::Tested)
+    {
+        this->schedulePreview();
+        return;
+    }
+    // A plan already holds its new names; it is carried out as saved,
+    // whatever the rules on screen say.
+    QMessageBox box(QMessageBox::Question, tr("改名計畫"), tr("要照這份計畫改名 %1 個項目嗎？").arg(task.size()), QMessageBox::NoButton, this);
+    box.setInformativeText(fileName);
+    QPushButton* apply = box.addButton(tr("改名"), QMessageBox::AcceptRole);
+    box.addButton(tr("稍後"), QMessageBox::RejectRole);
+    box.exec();
+    if (box.clickedButton() == apply)
+        this->startRenameJob(new RenameJob(this->taskHistory.top(), this));
+}
+
+void MainWindow::recoverJournal()
+{
+    if (this->isBusy())
+        return;
+    QStringList journals = RenameJournal::interrupted();
+    if (journals.isEmpty())
+        return;
+    QMessageBox box(QMessageBox::Warning, tr("上次改名未完成"), tr("上次改名在完成前中斷了。要把它完成，還是還原已改的檔名？"), QMessageBox::NoButton, this);
+    box.setInformativeText(journals.first());
+    QPushButton* finish = box.addButton(tr("完成改名"), QMessageBox::AcceptRole);
+    QPushButton* rollBack = box.addButton(tr("還原"), QMessageBox::DestructiveRole);
+    box.addButton(tr("略過"), QMessageBox::RejectRole);
+    box.exec();
+    if (box.clickedButton() == finish)
+        this->replayJournal(journals.first(), RenameJournal::Finish);
+    else if (box.clickedButton() == rollBack)
+        this->replayJournal(journals.first(), RenameJournal::RollBack);
+}
+
 void MainWindow::renameExtExcluded()
 {
     this->rename(Task::ExtExcluded);
@@ -375,6 +782,92 @@ void MainWindow::renameExtOnly()
     this->rename(Task::ExtOnly);
 }
 
+void MainWindow::saveTaskFile()
+{
+    if (this->isBusy() || this->taskHistory.isEmpty() || this->taskHistory.top().getStatus() != Task::Tested)
+        return;
+    QString fileName = QFileDialog::getSaveFileName(this, tr("儲存改名計畫"), QString(), tr("改名計畫 (*.koiplan)"));
+    if (fileName.isEmpty())
+        return;
+    TaskFile file(fileName);
+    if (!file.write(this->taskHistory.top()))
+        QMessageBox::warning(this, tr("無法儲存"), file.errorString());
+}
+
+void MainWindow::schedulePreview()
+{
+    // Every edit drops the computation under way at once; a new one only
+    // starts when the fields have been left alone for a moment.
+    this->cancelPreviewJob();
+    this->previewTimer->start();
+}
+
+void MainWindow::showPreview()
+{
+    if (!this->previewJob)
+        return;
+    foreach (const auto& chunk, this->previewJob->takeResults())
+        this->taskModel->setPreview(chunk.begin, chunk.fileNames);
+}
+
+void MainWindow::startPreview()
+{
+    this->cancelPreviewJob();
+    if (this->isBusy() || this->taskHistory.isEmpty() || this->taskHistory.top().isEmpty() || this->taskHistory.top().getStatus() == Task::Finished)
+    {
+        this->taskModel->clearPreview();
+        return;
+    }
+    // The preview shows what 改主檔名 would do.
+    RenamePlan plan = this->makePlan(Task::ExtExcluded);
+    if (!plan.isValid())
+    {
+        this->taskModel->clearPreview();
+        return;
+    }
+    QTableView* view = ui->tableView_TaskView;
+    qsizetype first = qMax(view->rowAt(0), 0);
+    qsizetype last = view->rowAt(view->viewport()->height() - 1);
+    last = last < 0 ? this->taskHistory.top().size() : last + 1;
+    this->taskModel->beginPreview();
+    this->previewJob = new PreviewJob(this->taskHistory.top(), plan, this->resolution, this->directorySnapshot, first, last, this);
+    this->connect(this->previewJob, &PreviewJob::resultsReady, this, &MainWindow::showPreview);
+    this->connect(this->previewJob, &PreviewJob::finished, this, &MainWindow::collectPreviewJob);
+    this->previewJob->start();
+}
+
+void MainWindow::showRenameProgress(qsizetype done, qsizetype failed, qsizetype total, double perSecond)
+{
+    ui->progressBar_Run->setMaximum(int(total));
+    ui->progressBar_Run->setValue(int(done + failed));
+    ui->progressBar_Run->setFormat(tr("%v / %m，失敗 %1，每秒 %2 個").arg(failed).arg(perSecond, 0, 'f', 0));
+}
+
+void MainWindow::showTaskMenu(const QPoint& position)
+{
+    QMenu menu(this);
+    QAction* open = menu.addAction(tr("開啟路徑清單或改名計畫…"));
+    this->connect(open, &QAction::triggered, this, &MainWindow::openTaskFile);
+    QAction* save = menu.addAction(tr("儲存改名計畫…"));
+    this->connect(save, &QAction::triggered, this, &MainWindow::saveTaskFile);
+    open->setEnabled(!this->isBusy());
+    // Only a test run leaves new names that have not been carried out.
+    save->setEnabled(!this->isBusy() && !this->taskHistory.isEmpty() && this->taskHistory.top().getStatus() == Task::Tested);
+    menu.addSeparator();
+    QAction* suffix = menu.addAction(tr("撞名時自動加上編號"));
+    suffix->setCheckable(true);
+    suffix->setChecked(this->resolution == Task::SuffixCollisions);
+    this->connect(suffix, &QAction::toggled, this, &MainWindow::switchToSuffixCollisions);
+    menu.exec(ui->tableView_TaskView->viewport()->mapToGlobal(position));
+}
+
+void MainWindow::undoLastRun()
+{
+    QStringList journals = RenameJournal::completed();
+    if (!this->isBusy() && !journals.isEmpty())
+        this->replayJournal(journals.first(), RenameJournal::RollBack);
+}
+
 void MainWindow::switchToDelete(bool checked)
 {
     if (checked)
@@ -394,3 +887,23 @@ void MainWindow::switchToInsert(bool checked)
     }
     ui->lineEdit_Insert->setVisible(checked);
 }
+
+void MainWindow::switchToOrder(int order)
+{
+    // Where the cursor was only matters in drop order.
+    ui->label_5->setVisible(order == RenamePlan::DropOrder);
+}
+
+void MainWindow::switchToRecursive(bool checked)
+{
+    ui->label_Depth->setEnabled(checked);
+    ui->spinBox_Depth->setEnabled(checked);
+    ui->comboBox_EntryType->setEnabled(checked);
+}
+
+void MainWindow::switchToSuffixCollisions(bool checked)
+{
+    // Applies to the preview as well as to the runs.
+    this->resolution = checked ? Task::SuffixCollisions : Task::ReportCollisions;
+    this->schedulePreview();
+}
@@ -2,8 +2,16 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QSharedPointer>
 #include <QStack>
+#include <QTimer>
+#include <directoryscanner.h>
+#include <directorysnapshot.h>
+#include <previewjob.h>
+#include <renamejob.h>
+#include <renamejournal.h>
 #include <task.h>
+#include <taskmodel.h>
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -23,20 +31,67 @@ protected:
     void dropEvent(QDropEvent*);
 
 private:
+    static constexpr int previewDelay = 150;
     Ui::MainWindow *ui;
     QStack<Task> taskHistory;
+    TaskModel* taskModel;
+    RenameJob* renameJob;
+    DirectoryScanner* directoryScanner;
+    PreviewJob* previewJob;
+    QTimer* previewTimer;
+    QSharedPointer<DirectorySnapshot> directorySnapshot;
+    Task::Resolution resolution;
+    QString replayedJournal;
+    bool hasCompletedJournal;
+    RenamePlan chain;
+    QStringList chainNames;
+    QString detectedCodePage;
+    Task::Rule detectedRule;
+    qsizetype detectedRows;
+    void cancelPreviewJob();
+    void chainRule(Task::Mask);
+    QString detectCodePage(Task::Rule);
+    void finishRename();
+    bool isBusy() const;
+    RenamePlan makePlan(Task::Mask);
+    RenamePlan makeRule(Task::Mask);
     void newTask();
     void rename(Task::Mask);
+    void replayJournal(const QString&, RenameJournal::Recovery);
     void setTaskView();
+    void startDirectoryScan(const QStringList&);
+    void startRenameJob(RenameJob*);
+    void stopPreview();
+    void updateChainLabel();
 
 private slots:
+    void appendScannedEntries();
+    void cancelWork();
+    void chainExtExcluded();
+    void chainExtOnly();
     void changeDigitsByOrdinal(const QString&);
     void changeOrdinalByDigits(int);
+    void clearChain();
+    void collectDirectoryScanner();
+    void collectPreviewJob();
+    void collectRenameJob();
     void enableRun(bool);
     void enableRunOrNot();
+    void openTaskFile();
+    void recoverJournal();
     void renameExtExcluded();
     void renameExtOnly();
+    void saveTaskFile();
+    void schedulePreview();
+    void showPreview();
+    void showRenameProgress(qsizetype, qsizetype, qsizetype, double);
+    void showTaskMenu(const QPoint&);
+    void startPreview();
     void switchToDelete(bool);
     void switchToInsert(bool);
+    void switchToOrder(int);
+    void switchToRecursive(bool);
+    void switchToSuffixCollisions(bool);
+    void undoLastRun();
 };
 #endif // MAINWINDOW_H
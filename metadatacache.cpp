@@ -0,0 +1,104 @@
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QtConcurrent/QtConcurrentMap>
+#include <limits>
+#include "metadatacache.h"
+#include "task.h"
+#include "trace.h"
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+MetadataCache::MetadataCache(quint64 owner)
+    : owner(owner)
+{
+}
+
+QList<qint64> MetadataCache::fetch(const Task& task, Field field) const
+{
+    qsizetype begin;
+    qsizetype size = task.size();
+    {
+        QMutexLocker locker(&this->mutex);
+        const QList<qint64>& values = this->values[field];
+        begin = values.size();
+        if (begin >= size)
+            return values.mid(0, size);
+    }
+    // The files are stat'ed without the lock, so a caller that only needs
+    // what is already kept, such as the GUI thread binding a plan, never
+    // waits for a stale preview's fetch.
+    Trace::Span span("fetchMetadata");
+    QList<qint64> fetched(size - begin);
+    QList<qsizetype> chunks;
+    for (qsizetype chunk = begin; chunk < size; chunk += MetadataCache::chunkSize)
+        chunks.append(chunk);
+    // Until a task has been renamed for real, its files are still under
+    // their original names.
+    qsizetype step = task.getStatus() == Task::Finished ? -1 : 0;
+    qint64* data = fetched.data();
+    QtConcurrent::blockingMap(chunks, [&task, field, step, begin, size, data](qsizetype chunk) {
+        qsizetype end = qMin(chunk + MetadataCache::chunkSize, size);
+        for (qsizetype i = chunk; i < end; ++i)
+            data[i - begin] = MetadataCache::read(task.filePath(i, step < 0 ? task.depth(i) - 1 : step), field);
+    });
+    // Another caller may have kept some of these meanwhile; only what is
+    // still missing is added.
+    QMutexLocker locker(&this->mutex);
+    QList<qint64>& values = this->values[field];
+    if (values.size() < size)
+        values.append(fetched.mid(values.size() - begin));
+    return values.mid(0, size);
+}
+
+bool MetadataCache::isOwnedBy(quint64 generation) const
+{
+    return this->owner == generation;
+}
+
+qint64 MetadataCache::read(const QString& path, Field field)
+{
+    // A file that cannot be read sorts last. Where the file system keeps no
+    // creation time, the modification time stands in for it.
+#if defined(Q_OS_LINUX) && defined(STATX_BTIME)
+    unsigned int mask;
+    switch (field)
+    {
+        case MetadataCache::Size:
+            mask = STATX_SIZE;
+        break;
+        case MetadataCache::Created:
+            mask = STATX_BTIME | STATX_MTIME;
+        break;
+        default:
+            mask = STATX_MTIME;
+        break;
+    }
+    struct statx buffer;
+    Trace::add(Trace::Syscalls);
+    if (statx(AT_FDCWD, QFile::encodeName(path).constData(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, &buffer) != 0)
+        return std::numeric_limits<qint64>::max();
+    if (field == MetadataCache::Size)
+        return qint64(buffer.stx_size);
+    const struct statx_timestamp& time = field == MetadataCache::Created && (buffer.stx_mask & STATX_BTIME) ? buffer.stx_btime : buffer.stx_mtime;
+    return qint64(time.tv_sec) * 1000000000 + time.tv_nsec;
+#else
+    QFileInfo info(path);
+    if (!info.exists() && !info.isSymLink())
+        return std::numeric_limits<qint64>::max();
+    switch (field)
+    {
+        case MetadataCache::Size:
+        return info.size();
+        case MetadataCache::Created:
+            if (info.birthTime().isValid())
+                return info.birthTime().toMSecsSinceEpoch() * 1000000;
+        return info.lastModified().toMSecsSinceEpoch() * 1000000;
+        default:
+        return info.lastModified().toMSecsSinceEpoch() * 1000000;
+    }
+#endif
+}
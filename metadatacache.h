@@ -0,0 +1,33 @@
+#ifndef METADATACACHE_H
+#define METADATACACHE_H
+
+#include <QList>
+#include <QMutex>
+
+class Task;
+
+// File metadata of a task's items, for the ordinal rules to sort by. A
+// field is fetched on first use with one statx() per item that asks for
+// that field alone, spread over the global thread pool, and then kept:
+// renames leave these fields alone and a task only ever grows, so later
+// runs just fetch what was appended since. Copies of a task share the
+// cache, which is owned by the task it was made for: only the owner
+// appends items to it, and a copy that appends starts a cache of its
+// own. fetch() may be called from any thread.
+class MetadataCache
+{
+public:
+    enum Field {Modified, Size, Created, FieldCount};
+    explicit MetadataCache(quint64);
+    QList<qint64> fetch(const Task&, Field) const;
+    bool isOwnedBy(quint64) const;
+
+private:
+    static constexpr qsizetype chunkSize = 4096;
+    mutable QMutex mutex;
+    quint64 owner;
+    mutable QList<qint64> values[FieldCount];
+    static qint64 read(const QString&, Field);
+};
+
+#endif // METADATACACHE_H
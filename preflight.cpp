@@ -0,0 +1,97 @@
+#include <QtConcurrent/QtConcurrentMap>
+#include "directorysnapshot.h"
+#include "preflight.h"
+#include "trace.h"
+
+// What one directory holds, and what the task does to it.
+struct Preflight::Directory
+{
+    const QString* prefix;
+    QSet<QString> existing;
+    QSet<QString> vacated;
+    QSet<QString> claimed;
+    QHash<QString, int> nextSuffix;
+    bool isTaken(const QString& key) const
+    {
+        return this->claimed.contains(key) || (this->existing.contains(key) && !this->vacated.contains(key));
+    }
+};
+
+QList<qsizetype> Preflight::check(const Task& task, QList<QString>& names, Task::Resolution resolution, DirectorySnapshot& snapshot)
+{
+    Trace::Span span("preflight");
+    qsizetype size = qMin(task.size(), names.size());
+    // Until a task has been renamed for real, its files are still under
+    // their original names.
+    bool finished = task.getStatus() == Task::Finished;
+    auto current = [finished](const Task::Entry& entry) {
+        return entry.fileNameView(finished ? entry.depth() - 1 : 0);
+    };
+    // A first pass finds the directories involved and the names leaving
+    // each of them, which are free for others to take.
+    QHash<quint32, Directory> directories;
+    for (const auto& entry : task.range(0, size))
+    {
+        const QString& name = names.at(entry.index());
+        QStringView from = current(entry);
+        if (name.isNull() || name == from)
+            continue;
+        Directory& directory = directories[entry.dirId()];
+        directory.prefix = &entry.dirPrefix();
+        directory.vacated.insert(DirectorySnapshot::key(from));
+    }
+    QList<qsizetype> collisions;
+    if (directories.isEmpty())
+        return collisions;
+    QList<Directory*> involved;
+    for (auto it = directories.begin(); it != directories.end(); ++it)
+        involved.append(&it.value());
+    QtConcurrent::blockingMap(involved, [&snapshot](Directory* directory) {
+        directory->existing = snapshot.names(*directory->prefix);
+    });
+    // The second pass hands the names out in item order, so the first item
+    // after a name gets it and the later ones collide.
+    for (const auto& entry : task.range(0, size))
+    {
+        const QString& name = names.at(entry.index());
+        if (name.isNull() || name == current(entry))
+            continue;
+        Directory& directory = directories[entry.dirId()];
+        QString key = DirectorySnapshot::key(name);
+        if (!directory.isTaken(key))
+        {
+            directory.claimed.insert(key);
+            continue;
+        }
+        collisions.append(entry.index());
+        if (resolution != Task::SuffixCollisions)
+            continue;
+        // Numbering picks up where the last item after the same name
+        // stopped, so a thousand equal names are not tried a thousand
+        // times each.
+        int& next = directory.nextSuffix[key];
+        next = qMax(next, 2);
+        QString free;
+        QString freeKey;
+        for (;; ++next)
+        {
+            free = Preflight::suffixed(name, next);
+            freeKey = DirectorySnapshot::key(free);
+            if (!directory.isTaken(freeKey))
+                break;
+        }
+        ++next;
+        directory.claimed.insert(freeKey);
+        names[entry.index()] = free;
+    }
+    return collisions;
+}
+
+QString Preflight::suffixed(QStringView fileName, int number)
+{
+    // The number goes before the suffix; a leading dot does not start one.
+    qsizetype dot = fileName.lastIndexOf(QChar('.'));
+    if (dot <= 0)
+        dot = fileName.size();
+    return fileName.left(dot).toString() + " (" + QString::number(number) + ")" + fileName.mid(dot).toString();
+}
@@ -0,0 +1,28 @@
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include <task.h>
+
+class DirectorySnapshot;
+
+// Checks the new names of a task before anything is renamed. A new name
+// collides when its directory already holds an entry by that name that
+// is not being renamed away itself, or when an earlier item of the same
+// directory takes it too; swaps and cycles within the task are fine, as
+// the scheduler sorts them out. Each directory involved comes from the
+// snapshot once and every name costs a few hash lookups, so a check is
+// linear in the size of the task. The names are given per item, a null
+// string for an item that keeps its name; with SuffixCollisions a
+// colliding one becomes "name (2).ext", "name (3).ext"... whichever is
+// free first. The items found colliding are returned in order.
+class Preflight
+{
+public:
+    static QList<qsizetype> check(const Task&, QList<QString>&, Task::Resolution, DirectorySnapshot&);
+
+private:
+    struct Directory;
+    static QString suffixed(QStringView, int);
+};
+
+#endif // PREFLIGHT_H
@@ -0,0 +1,97 @@
+#include <QFile>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QtTest>
+#include "directorysnapshot.h"
+#include "preflight.h"
+
+// Checks new names against a real directory: names taken on disk or by an
+// earlier item collide, names left by items renamed away do not, and
+// numbering skips whatever is taken until a name is free.
+
+class PreflightTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void numbersTakenNames();
+    void reportsTakenNames();
+    void suffixesTestRun();
+    void vacatedNamesAreFree();
+
+private:
+    QScopedPointer<QTemporaryDir> dir;
+    Task taskOf(const QStringList&) const;
+    void touch(const QStringList&) const;
+};
+
+void PreflightTest::init()
+{
+    this->dir.reset(new QTemporaryDir);
+    QVERIFY(this->dir->isValid());
+    this->touch({"a.txt", "b.txt", "c.txt", "d.txt", "keep.txt", "keep (2).txt", ".cfg"});
+}
+
+void PreflightTest::numbersTakenNames()
+{
+    Task task = this->taskOf({"a.txt", "b.txt", "c.txt", "d.txt"});
+    QList<QString> names = {"keep.txt", "keep.txt", ".cfg", "new.txt"};
+    DirectorySnapshot snapshot;
+    QCOMPARE(Preflight::check(task, names, Task::SuffixCollisions, snapshot), QList<qsizetype>({0, 1, 2}));
+    QCOMPARE(names, QList<QString>({"keep (3).txt", "keep (4).txt", ".cfg (2)", "new.txt"}));
+}
+
+void PreflightTest::reportsTakenNames()
+{
+    // The first item after a new name gets it, a later one collides.
+    Task task = this->taskOf({"a.txt", "b.txt", "c.txt", "d.txt"});
+    QList<QString> names = {"keep.txt", "new.txt", QString(), "new.txt"};
+    DirectorySnapshot snapshot;
+    QCOMPARE(Preflight::check(task, names, Task::ReportCollisions, snapshot), QList<qsizetype>({0, 3}));
+    QCOMPARE(names, QList<QString>({"keep.txt", "new.txt", QString(), "new.txt"}));
+}
+
+void PreflightTest::suffixesTestRun()
+{
+    // A test run keeps the numbered names as the new step of its items.
+    Task task;
+    task.append(this->dir->filePath("a.txt"), "keep.txt");
+    task.append(this->dir->filePath("b.txt"), "b.txt");
+    task.append(this->dir->filePath("c.txt"), "keep.txt");
+    QCOMPARE(task.preflight(Task::SuffixCollisions), QList<qsizetype>({0, 2}));
+    QCOMPARE(task.fileName(0, 1), QStringLiteral("keep (3).txt"));
+    QCOMPARE(task.fileName(1, 1), QStringLiteral("b.txt"));
+    QCOMPARE(task.fileName(2, 1), QStringLiteral("keep (4).txt"));
+    QCOMPARE(task.depth(0), qsizetype(2));
+}
+
+void PreflightTest::vacatedNamesAreFree()
+{
+    // A swap, a new name, and a name left by another item.
+    Task task = this->taskOf({"a.txt", "b.txt", "c.txt", "d.txt"});
+    QList<QString> names = {"b.txt", "a.txt", "x.txt", "c.txt"};
+    DirectorySnapshot snapshot;
+    QCOMPARE(Preflight::check(task, names, Task::SuffixCollisions, snapshot), QList<qsizetype>());
+    QCOMPARE(names, QList<QString>({"b.txt", "a.txt", "x.txt", "c.txt"}));
+}
+
+Task PreflightTest::taskOf(const QStringList& fileNames) const
+{
+    Task task;
+    task.append(this->dir->path() + "/", fileNames);
+    return task;
+}
+
+void PreflightTest::touch(const QStringList& names) const
+{
+    foreach (const auto& name, names)
+    {
+        QFile file(this->dir->filePath(name));
+        file.open(QIODevice::WriteOnly);
+    }
+}
+
+QTEST_GUILESS_MAIN(PreflightTest)
+
+#include "preflighttest.moc"
@@ -0,0 +1,146 @@
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+#include "preflight.h"
+#include "previewjob.h"
+#include "trace.h"
+
+PreviewJob::PreviewJob(const Task& task, const RenamePlan& plan, Task::Resolution resolution, const QSharedPointer<DirectorySnapshot>& snapshot, qsizetype firstVisible, qsizetype lastVisible, QObject *parent)
+    : QObject(parent)
+    , task(task)
+    , plan(plan)
+    , resolution(resolution)
+    , snapshot(snapshot)
+    , firstVisible(qBound(qsizetype(0), firstVisible, task.size()))
+    , lastVisible(qBound(qsizetype(0), lastVisible, task.size()))
+    , canceled(0)
+{
+    this->connect(&this->watcher, &QFutureWatcher<void>::finished, this, &PreviewJob::finished);
+}
+
+PreviewJob::~PreviewJob()
+{
+    this->cancel();
+    this->wait();
+}
+
+void PreviewJob::cancel()
+{
+    this->canceled.storeRelaxed(1);
+}
+
+QList<qsizetype> PreviewJob::collisions() const
+{
+    // Only complete once the job has finished.
+    return this->found;
+}
+
+bool PreviewJob::isCanceled() const
+{
+    return this->canceled.loadRelaxed();
+}
+
+bool PreviewJob::isRunning() const
+{
+    return this->watcher.isRunning();
+}
+
+void PreviewJob::start()
+{
+    this->watcher.setFuture(QtConcurrent::run([this]() {
+        this->run();
+    }));
+}
+
+QList<PreviewJob::Chunk> PreviewJob::takeResults()
+{
+    QMutexLocker locker(&this->mutex);
+    QList<Chunk> results;
+    results.swap(this->ready);
+    return results;
+}
+
+void PreviewJob::wait()
+{
+    this->watcher.waitForFinished();
+}
+
+void PreviewJob::preflight(const QList<Chunk>& chunks)
+{
+    QList<QString> names(this->task.size());
+    foreach (const auto& chunk, chunks)
+        std::copy(chunk.fileNames.cbegin(), chunk.fileNames.cend(), names.begin() + chunk.begin);
+    this->found = Preflight::check(this->task, names, this->resolution, *this->snapshot);
+    if (this->resolution != Task::SuffixCollisions || this->found.isEmpty())
+        return;
+    // The names given a number are sent again, as one run from the first
+    // to the last of them.
+    Chunk resolved;
+    resolved.begin = this->found.first();
+    resolved.fileNames = names.mid(resolved.begin, this->found.last() + 1 - resolved.begin);
+    this->publish(resolved);
+}
+
+void PreviewJob::preview(Chunk& chunk) const
+{
+    // Names are always derived from the original ones, like
+    // Task::renameTestAll does after resetting the histories. A name the
+    // plan leaves alone stays a null string.
+    qsizetype end = chunk.begin + chunk.fileNames.size();
+    QString modFileName;
+    for (qsizetype i = chunk.begin; i < end; ++i)
+        if (this->plan.apply(this->task.fileNameView(i, 0), i, modFileName))
+            chunk.fileNames[i - chunk.begin] = modFileName;
+}
+
+void PreviewJob::publish(const Chunk& chunk)
+{
+    // The names are shared, not copied, with the chunk the job keeps for
+    // the preflight.
+    bool wasEmpty;
+    {
+        QMutexLocker locker(&this->mutex);
+        wasEmpty = this->ready.isEmpty();
+        this->ready.append(chunk);
+    }
+    if (wasEmpty)
+        emit this->resultsReady();
+}
+
+void PreviewJob::run()
+{
+    Trace::Span span("preview");
+    // Sorted ordinal rules need the whole task, and maybe its metadata,
+    // before even the visible rows can be numbered.
+    this->plan.bind(this->task);
+    auto makeChunk = [](qsizetype begin, qsizetype end) {
+        Chunk chunk;
+        chunk.begin = begin;
+        chunk.fileNames.resize(end - begin);
+        return chunk;
+    };
+    QList<Chunk> chunks;
+    if (this->firstVisible < this->lastVisible)
+    {
+        Chunk visible = makeChunk(this->firstVisible, this->lastVisible);
+        this->preview(visible);
+        this->publish(visible);
+        chunks.append(visible);
+    }
+    // The rest goes from the rows below the view to the end, then from
+    // the top down to the view, which is the order a user scrolls in.
+    qsizetype first = chunks.size();
+    qsizetype size = this->task.size();
+    for (qsizetype begin = this->lastVisible; begin < size; begin += PreviewJob::chunkSize)
+        chunks.append(makeChunk(begin, qMin(begin + PreviewJob::chunkSize, size)));
+    for (qsizetype begin = 0; begin < this->firstVisible; begin += PreviewJob::chunkSize)
+        chunks.append(makeChunk(begin, qMin(begin + PreviewJob::chunkSize, this->firstVisible)));
+    QtConcurrent::blockingMap(chunks.begin() + first, chunks.end(), [this](Chunk& chunk) {
+        if (this->isCanceled())
+            return;
+        this->preview(chunk);
+        this->publish(chunk);
+    });
+    if (!this->isCanceled())
+        this->preflight(chunks);
+}
@@ -0,0 +1,62 @@
+#ifndef PREVIEWJOB_H
+#define PREVIEWJOB_H
+
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QMutex>
+#include <QSharedPointer>
+#include <directorysnapshot.h>
+#include <renameplan.h>
+#include <task.h>
+
+// Computes the names a plan would give, without touching the task, for
+// the live preview. The rows in view are done first and published on
+// their own; the rest follows in chunks on the global thread pool. Once
+// every name is known they are checked for collisions against the shared
+// directory snapshot; names changed to resolve them are published again.
+// A job works on its own copy of the task, so a stale one can simply be
+// canceled and left to finish.
+class PreviewJob : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Chunk
+    {
+        qsizetype begin;
+        QStringList fileNames;
+    };
+    PreviewJob(const Task&, const RenamePlan&, Task::Resolution, const QSharedPointer<DirectorySnapshot>&, qsizetype, qsizetype, QObject *parent = nullptr);
+    ~PreviewJob();
+    void cancel();
+    QList<qsizetype> collisions() const;
+    bool isCanceled() const;
+    bool isRunning() const;
+    void start();
+    QList<Chunk> takeResults();
+    void wait();
+
+signals:
+    void finished();
+    void resultsReady();
+
+private:
+    static constexpr qsizetype chunkSize = 2048;
+    Task task;
+    RenamePlan plan;
+    Task::Resolution resolution;
+    QSharedPointer<DirectorySnapshot> snapshot;
+    qsizetype firstVisible;
+    qsizetype lastVisible;
+    QMutex mutex;
+    QList<Chunk> ready;
+    QList<qsizetype> found;
+    QAtomicInt canceled;
+    QFutureWatcher<void> watcher;
+    void preflight(const QList<Chunk>&);
+    void preview(Chunk&) const;
+    void publish(const Chunk&);
+    void run();
+};
+
+#endif // PREVIEWJOB_H
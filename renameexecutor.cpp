@@ -0,0 +1,233 @@
+#include <QFile>
+#include <QScopedPointer>
+#include "renameexecutor.h"
+#include "trace.h"
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+#endif
+
+// The ring of the current thread, set up by its first batching executor;
+// a kernel without io_uring is only probed once per thread.
+namespace
+{
+    struct ThreadRing
+    {
+        QScopedPointer<RenameRing> ring;
+        bool probed = false;
+    };
+
+    thread_local ThreadRing threadRing;
+}
+
+RenameExecutor::RenameExecutor(const HistoryStore& store, bool batching)
+    : store(store)
+    , noReplace(true)
+    , ring(nullptr)
+{
+    if (batching && qEnvironmentVariable("KOI_RENAMER_IO_URING") != "0")
+    {
+        if (!threadRing.probed)
+        {
+            threadRing.probed = true;
+            threadRing.ring.reset(new RenameRing(RenameExecutor::ringEntries));
+            if (!threadRing.ring->isValid())
+                threadRing.ring.reset();
+        }
+        this->ring = threadRing.ring.data();
+    }
+}
+
+RenameExecutor::~RenameExecutor()
+{
+    // What is in flight is waited for before the descriptors and the paths
+    // go, leaving the ring empty for the next executor of the thread.
+    if (this->ring && this->ring->inFlight())
+        this->reap(this->ring->inFlight());
+    this->closeAll();
+}
+
+QString RenameExecutor::errorString() const
+{
+    return this->error;
+}
+
+bool RenameExecutor::isBatching() const
+{
+    // A filesystem that refused an exclusive rename is left to rename(),
+    // which knows how to do without.
+    return this->ring && this->noReplace;
+}
+
+bool RenameExecutor::rename(quint32 dir, const QString& from, const QString& to)
+{
+#if defined(Q_OS_LINUX) && defined(SYS_renameat2)
+    int fd = this->dirfd(dir);
+    if (fd < 0)
+        return false;
+    QByteArray fromName = QFile::encodeName(from);
+    QByteArray toName = QFile::encodeName(to);
+    if (this->noReplace)
+    {
+        Trace::add(Trace::Syscalls);
+        if (syscall(SYS_renameat2, fd, fromName.constData(), fd, toName.constData(), RENAME_NOREPLACE) == 0)
+            return true;
+        if (errno != EINVAL && errno != ENOSYS)
+        {
+            this->error = QString::fromLocal8Bit(strerror(errno));
+            return false;
+        }
+        // The kernel or the filesystem (e.g. older NFS) cannot do an
+        // exclusive rename; check the target first like QFile::rename.
+        this->noReplace = false;
+    }
+    struct stat target;
+    Trace::add(Trace::Syscalls);
+    if (fstatat(fd, toName.constData(), &target, AT_SYMLINK_NOFOLLOW) == 0)
+    {
+        this->error = QString::fromLocal8Bit(strerror(EEXIST));
+        return false;
+    }
+    Trace::add(Trace::Syscalls);
+    if (renameat(fd, fromName.constData(), fd, toName.constData()) == 0)
+        return true;
+    this->error = QString::fromLocal8Bit(strerror(errno));
+    return false;
+#else
+    const QString& prefix = this->store.dirAt(dir);
+    QFile file(prefix + from);
+    Trace::add(Trace::Syscalls);
+    if (file.rename(prefix + to))
+        return true;
+    this->error = file.errorString();
+    return false;
+#endif
+}
+
+void RenameExecutor::submit(quint32 dir, const QString& from, const QString& to, qsizetype tag)
+{
+    if (!this->isBatching())
+    {
+        this->completed.append(Completion{tag, this->rename(dir, from, to)});
+        return;
+    }
+#ifdef Q_OS_LINUX
+    int fd = this->dirfd(dir);
+    if (fd < 0)
+    {
+        this->completed.append(Completion{tag, false});
+        return;
+    }
+    // A full ring is drained by a quarter at a time, so every
+    // io_uring_enter() submits and collects a batch.
+    if (this->ring->isFull())
+        this->reap(RenameExecutor::ringEntries / 4);
+    Submission& submission = this->submissions[tag];
+    submission.dir = dir;
+    submission.from = from;
+    submission.to = to;
+    submission.fromName = QFile::encodeName(from);
+    submission.toName = QFile::encodeName(to);
+    Trace::add(Trace::Syscalls);
+    this->ring->push(fd, submission.fromName.constData(), submission.toName.constData(), RENAME_NOREPLACE, quint64(tag));
+#endif
+}
+
+QList<RenameExecutor::Completion> RenameExecutor::takeCompleted(bool wait)
+{
+    if (wait && this->ring && this->ring->inFlight())
+        this->reap(this->ring->inFlight());
+    QList<Completion> completed;
+    completed.swap(this->completed);
+    return completed;
+}
+
+void RenameExecutor::closeAll()
+{
+#ifdef Q_OS_LINUX
+    foreach (int fd, this->dirfds)
+        if (fd >= 0)
+            close(fd);
+#endif
+    this->dirfds.clear();
+}
+
+int RenameExecutor::dirfd(quint32 dir)
+{
+#ifdef Q_OS_LINUX
+    QHash<quint32, int>::const_iterator found = this->dirfds.constFind(dir);
+    if (found != this->dirfds.cend())
+        return found.value();
+    const QString& prefix = this->store.dirAt(dir);
+    int fd = open(prefix.isEmpty() ? "." : QFile::encodeName(prefix).constData(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    Trace::add(Trace::Syscalls);
+    if (fd < 0)
+        this->error = QString::fromLocal8Bit(strerror(errno));
+    this->dirfds.insert(dir, fd);
+    return fd;
+#else
+    Q_UNUSED(dir);
+    return -1;
+#endif
+}
+
+void RenameExecutor::reap(qsizetype minimum)
+{
+#ifdef Q_OS_LINUX
+    QList<RenameRing::Completion> results;
+    bool reaped = this->ring->reap(results, unsigned(minimum));
+    int ringError = errno;
+    foreach (const auto& result, results)
+    {
+        Submission submission = this->submissions.take(qsizetype(result.tag));
+        if (result.result == -EINVAL)
+        {
+            // The filesystem cannot rename exclusively; rename() finds
+            // out again and switches to its fallback for good.
+            this->completed.append(Completion{qsizetype(result.tag), this->rename(submission.dir, submission.from, submission.to)});
+        }
+        else
+        {
+            if (result.result < 0)
+                this->error = QString::fromLocal8Bit(strerror(-result.result));
+            this->completed.append(Completion{qsizetype(result.tag), result.result == 0});
+        }
+    }
+    if (!reaped)
+    {
+        // Nothing more can be learnt from a broken ring, yet the kernel
+        // may have carried out the renames left in it. Once the ring is
+        // gone each is looked up on disk: a source gone and a target there
+        // is a rename done, anything else is tried again one at a time,
+        // as is everything after. The thread sets up a new ring for its
+        // next executor.
+        this->error = QString::fromLocal8Bit(strerror(ringError));
+        qWarning() << "io_uring failed: " << this->error;
+        this->ring = nullptr;
+        threadRing.ring.reset();
+        threadRing.probed = false;
+        for (auto it = this->submissions.cbegin(); it != this->submissions.cend(); ++it)
+        {
+            const Submission& submission = it.value();
+            int fd = this->dirfd(submission.dir);
+            struct stat status;
+            Trace::add(Trace::Syscalls, 2);
+            bool done = fd >= 0
+                && fstatat(fd, submission.fromName.constData(), &status, AT_SYMLINK_NOFOLLOW) != 0 && errno == ENOENT
+                && fstatat(fd, submission.toName.constData(), &status, AT_SYMLINK_NOFOLLOW) == 0;
+            this->completed.append(Completion{it.key(), done || this->rename(submission.dir, submission.from, submission.to)});
+        }
+        this->submissions.clear();
+    }
+#else
+    Q_UNUSED(minimum);
+#endif
+}
@@ -0,0 +1,61 @@
+#ifndef RENAMEEXECUTOR_H
+#define RENAMEEXECUTOR_H
+
+#include <QHash>
+#include <historystore.h>
+#include <renamering.h>
+
+// Carries out renames inside the interned directories of a HistoryStore.
+// On Linux every directory is opened once and renames are issued relative
+// to it with renameat2(RENAME_NOREPLACE), so an existing target fails
+// atomically; elsewhere it falls back to QFile::rename.
+//
+// rename() works one at a time. submit() queues renames on an io_uring
+// when the kernel has IORING_OP_RENAMEAT, keeping up to ringEntries in
+// flight, and hands back their outcomes through takeCompleted() under the
+// tags they were submitted with; without a ring (not asked for, or
+// KOI_RENAMER_IO_URING=0), it renames on the spot. Setting up a ring
+// takes a few syscalls and mappings, so each thread keeps one for the
+// executors it runs one after another.
+//
+// An executor serves one shard of a run, which lies in one directory, so
+// the descriptors it opens are few and kept until it goes.
+class RenameExecutor
+{
+public:
+    struct Completion
+    {
+        qsizetype tag;
+        bool succeeded;
+    };
+    RenameExecutor(const HistoryStore&, bool batching = true);
+    ~RenameExecutor();
+    QString errorString() const;
+    bool isBatching() const;
+    bool rename(quint32, const QString&, const QString&);
+    void submit(quint32, const QString&, const QString&, qsizetype);
+    QList<Completion> takeCompleted(bool);
+
+private:
+    struct Submission
+    {
+        quint32 dir;
+        QString from;
+        QString to;
+        QByteArray fromName;
+        QByteArray toName;
+    };
+    static constexpr unsigned ringEntries = 256;
+    const HistoryStore& store;
+    QHash<quint32, int> dirfds;
+    QString error;
+    bool noReplace;
+    RenameRing* ring;
+    QHash<qsizetype, Submission> submissions;
+    QList<Completion> completed;
+    void closeAll();
+    int dirfd(quint32);
+    void reap(qsizetype);
+};
+
+#endif // RENAMEEXECUTOR_H
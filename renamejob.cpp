@@ -0,0 +1,121 @@
+#include <QtConcurrent/QtConcurrentRun>
+#include "renamejob.h"
+#include "renamejournal.h"
+
+RenameJob::RenameJob(const Task& task, const RenamePlan& plan, QObject *parent)
+    : QObject(parent)
+    , task(task)
+    , plan(plan)
+    , preview(true)
+    , resolution(Task::ReportCollisions)
+    , failed(0)
+    , canceled(0)
+    , lastReport(0)
+{
+    this->connect(&this->watcher, &QFutureWatcher<void>::finished, this, &RenameJob::finished);
+}
+
+RenameJob::RenameJob(const Task& task, QObject *parent)
+    : RenameJob(task, RenamePlan(), parent)
+{
+    this->preview = false;
+}
+
+RenameJob::~RenameJob()
+{
+    this->cancel();
+    this->wait();
+}
+
+void RenameJob::cancel()
+{
+    this->canceled.storeRelaxed(1);
+}
+
+QString RenameJob::errorString() const
+{
+    return this->error;
+}
+
+qsizetype RenameJob::failures() const
+{
+    return this->failed;
+}
+
+bool RenameJob::isCanceled() const
+{
+    return this->canceled.loadRelaxed();
+}
+
+bool RenameJob::isRunning() const
+{
+    return this->watcher.isRunning();
+}
+
+Task RenameJob::result() const
+{
+    return this->task;
+}
+
+void RenameJob::setResolution(Task::Resolution resolution)
+{
+    this->resolution = resolution;
+}
+
+void RenameJob::start()
+{
+    this->timer.start();
+    this->watcher.setFuture(QtConcurrent::run([this]() {
+        this->run();
+    }));
+}
+
+void RenameJob::wait()
+{
+    this->watcher.waitForFinished();
+}
+
+bool RenameJob::report(qsizetype done, qsizetype failed, qsizetype total)
+{
+    // Progress is throttled so that a fast run does not flood the GUI
+    // thread with queued signals.
+    qint64 elapsed = this->timer.elapsed();
+    this->failed = failed;
+    if (elapsed - this->lastReport >= RenameJob::reportInterval || done + failed == total)
+    {
+        this->lastReport = elapsed;
+        emit this->progressChanged(done, failed, total, elapsed ? done * 1000.0 / elapsed : 0.0);
+    }
+    return !this->isCanceled();
+}
+
+void RenameJob::run()
+{
+    // Without a journal a crash would lose both undo and recovery, so the
+    // run does not start at all.
+    RenameJournal journal;
+    if (!journal.open())
+    {
+        this->error = journal.errorString();
+        return;
+    }
+    Task::Progress progress = [this](qsizetype done, qsizetype failed, qsizetype total) {
+        return this->report(done, failed, total);
+    };
+    if (this->preview && this->resolution == Task::SuffixCollisions)
+    {
+        // The names are checked against the directories as they are right
+        // before the run; without numbering, a taken name simply fails.
+        if (this->task.renameTestAll(this->plan))
+        {
+            this->task.preflight(this->resolution);
+            this->task.executeAll(progress, &journal);
+        }
+    }
+    else if (this->preview)
+    {
+        this->task.renameAll(this->plan, progress, &journal);
+    }
+    else
+        this->task.executeAll(progress, &journal);
+}
@@ -0,0 +1,54 @@
+#ifndef RENAMEJOB_H
+#define RENAMEJOB_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <renameplan.h>
+#include <task.h>
+
+// Runs Task::renameAll, or Task::executeAll for a task whose histories are
+// already set, on a copy of the task in a worker thread, journaling the run
+// and reporting progress through signals. The resulting task, with its
+// histories trimmed to what was actually renamed, is available after
+// finished(). Colliding new names can be numbered just before the run. A
+// run that cannot be journaled renames nothing and sets errorString().
+class RenameJob : public QObject
+{
+    Q_OBJECT
+
+public:
+    RenameJob(const Task&, const RenamePlan&, QObject *parent = nullptr);
+    RenameJob(const Task&, QObject *parent = nullptr);
+    ~RenameJob();
+    void cancel();
+    QString errorString() const;
+    qsizetype failures() const;
+    bool isCanceled() const;
+    bool isRunning() const;
+    Task result() const;
+    void setResolution(Task::Resolution);
+    void start();
+    void wait();
+
+signals:
+    void finished();
+    void progressChanged(qsizetype, qsizetype, qsizetype, double);
+
+private:
+    static constexpr qint64 reportInterval = 100;
+    Task task;
+    RenamePlan plan;
+    bool preview;
+    Task::Resolution resolution;
+    QString error;
+    qsizetype failed;
+    QAtomicInt canceled;
+    QElapsedTimer timer;
+    qint64 lastReport;
+    QFutureWatcher<void> watcher;
+    bool report(qsizetype, qsizetype, qsizetype);
+    void run();
+};
+
+#endif // RENAMEJOB_H
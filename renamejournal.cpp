@@ -0,0 +1,360 @@
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QCoreApplication>
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include "renamejournal.h"
+
+#if defined(Q_OS_UNIX)
+#include <unistd.h>
+#elif defined(Q_OS_WIN)
+#include <io.h>
+#endif
+
+static const char journalMagic[] = "KOIJRNL1";
+static const char journalTrailer[] = "KOIJEND1";
+
+RenameJournal::RenameJournal()
+    : unsynced(0)
+{
+}
+
+RenameJournal::~RenameJournal()
+{
+    if (this->file.isOpen())
+    {
+        // Dropped without close(): keep the run marked as interrupted.
+        this->sync();
+        this->file.close();
+    }
+}
+
+void RenameJournal::close()
+{
+    if (!this->file.isOpen())
+        return;
+    this->stream << quint8('E');
+    this->stream.writeRawData(journalTrailer, sizeof(journalTrailer) - 1);
+    this->sync();
+    this->file.close();
+    // Only the latest runs are kept around for undo.
+    QStringList done = RenameJournal::completed();
+    for (qsizetype i = RenameJournal::keepCompleted; i < done.size(); ++i)
+        QFile::remove(done.at(i));
+}
+
+QString RenameJournal::errorString() const
+{
+    return this->error;
+}
+
+QString RenameJournal::fileName() const
+{
+    return this->file.fileName();
+}
+
+bool RenameJournal::open()
+{
+    QDir dir(RenameJournal::directory());
+    if (!dir.mkpath("."))
+    {
+        this->error = tr("無法建立改名日誌的資料夾 %1。").arg(QDir::toNativeSeparators(dir.path()));
+        qWarning() << "Cannot create rename journal directory: " << dir.path();
+        return false;
+    }
+    QString name = QString("%1-%2.journal").arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss-zzz")).arg(QCoreApplication::applicationPid());
+    this->file.setFileName(dir.filePath(name));
+    if (!this->file.open(QIODevice::WriteOnly | QIODevice::NewOnly))
+    {
+        this->error = tr("無法寫入改名日誌 %1：%2").arg(QDir::toNativeSeparators(this->file.fileName()), this->file.errorString());
+        qWarning() << "Cannot open rename journal: " << this->file.errorString();
+        return false;
+    }
+    this->stream.setDevice(&this->file);
+    this->stream.setVersion(QDataStream::Qt_6_0);
+    this->stream.writeRawData(journalMagic, sizeof(journalMagic) - 1);
+    this->unsynced = 0;
+    return true;
+}
+
+void RenameJournal::plan(const QString& from, const QString& to)
+{
+    this->write('P', from, to);
+}
+
+void RenameJournal::planTemporary(const QString& from, const QString& temporary)
+{
+    // Followed by the plan from the temporary name to the target.
+    this->write('T', from, temporary);
+}
+
+void RenameJournal::record(const QString& from, const QString& to)
+{
+    this->write('R', from, to);
+    if (++this->unsynced >= RenameJournal::syncInterval)
+        this->sync();
+}
+
+void RenameJournal::sync()
+{
+    if (!this->file.isOpen())
+        return;
+    this->file.flush();
+#if defined(Q_OS_UNIX)
+    ::fsync(this->file.handle());
+#elif defined(Q_OS_WIN)
+    ::_commit(this->file.handle());
+#endif
+    this->unsynced = 0;
+}
+
+QStringList RenameJournal::completed()
+{
+    QStringList done;
+    foreach (const auto& journal, RenameJournal::journals())
+        if (RenameJournal::isComplete(journal))
+            done.append(journal);
+    return done;
+}
+
+QString RenameJournal::directory()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)).filePath("journal");
+}
+
+QStringList RenameJournal::interrupted()
+{
+    QStringList pending;
+    foreach (const auto& journal, RenameJournal::journals())
+        if (!RenameJournal::isComplete(journal))
+            pending.append(journal);
+    return pending;
+}
+
+bool RenameJournal::isComplete(const QString& path)
+{
+    // The end marker is a fixed trailer, so this never reads the records.
+    QFile file(path);
+    qint64 size = sizeof(journalTrailer) - 1;
+    if (!file.open(QIODevice::ReadOnly) || file.size() < size || !file.seek(file.size() - size))
+        return false;
+    return file.read(size) == QByteArray(journalTrailer, size);
+}
+
+Task RenameJournal::recover(const QString& path, Recovery recovery, QStringList* unresolved)
+{
+    Task task;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return task;
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_6_0);
+    QByteArray magic(sizeof(journalMagic) - 1, '\0');
+    if (stream.readRawData(magic.data(), magic.size()) != magic.size() || magic != QByteArray(journalMagic))
+        return task;
+    // Replay the recorded renames to find where every planned file is now.
+    // A torn record at the end of a crashed run simply ends the replay.
+    QList<QPair<QString, QString>> planned;
+    QHash<QString, qsizetype> byOrigin;
+    QHash<QString, QString> parkedAs;
+    QMultiHash<QString, QString> temporaries;
+    QHash<QString, QString> origin;
+    QHash<QString, QString> current;
+    bool complete = false;
+    while (!stream.atEnd())
+    {
+        quint8 type;
+        QString from;
+        QString to;
+        stream >> type;
+        if (stream.status() != QDataStream::Ok)
+            break;
+        if (type == 'E')
+        {
+            complete = true;
+            break;
+        }
+        stream >> from >> to;
+        if (stream.status() != QDataStream::Ok)
+            break;
+        if (type == 'T')
+        {
+            // The plan of a parked file starts from its temporary name.
+            parkedAs.insert(to, from);
+            temporaries.insert(from, to);
+        }
+        else if (type == 'P')
+        {
+            from = parkedAs.value(from, from);
+            if (byOrigin.contains(from))
+                continue;
+            byOrigin.insert(from, planned.size());
+            planned.append(qMakePair(from, to));
+            origin.insert(from, from);
+        }
+        else if (type == 'R' && origin.contains(from))
+        {
+            QString o = origin.take(from);
+            origin.insert(to, o);
+            current.insert(o, to);
+        }
+    }
+    // A plan's target is the source of at most one other plan, so plans
+    // form chains and cycles; a cycle is named after one of its plans.
+    QList<qsizetype> next(planned.size(), -1);
+    QList<qsizetype> previous(planned.size(), -1);
+    for (qsizetype i = 0; i < planned.size(); ++i)
+    {
+        qsizetype j = byOrigin.value(planned.at(i).second, -1);
+        if (j >= 0 && j != i)
+        {
+            next[i] = j;
+            previous[j] = i;
+        }
+    }
+    QList<qsizetype> cycle(planned.size(), -1);
+    QList<char> visited(planned.size(), 0);
+    for (qsizetype i = 0; i < planned.size(); ++i)
+    {
+        QList<qsizetype> walk;
+        qsizetype j = i;
+        for (; j >= 0 && !visited.at(j); j = next.at(j))
+        {
+            visited[j] = 1;
+            walk.append(j);
+        }
+        if (j >= 0 && visited.at(j) == 1)
+            for (qsizetype k = walk.indexOf(j); k < walk.size(); ++k)
+                cycle[walk.at(k)] = j;
+        foreach (qsizetype k, walk)
+            visited[k] = 2;
+    }
+    // Entries are renamed before the directories above them, so every
+    // recorded path is relative to parents that had not moved yet. Plans
+    // are resolved from the top down, mapping each moved directory to its
+    // current place so that the paths below it can be corrected.
+    QList<qsizetype> byLevel(planned.size());
+    std::iota(byLevel.begin(), byLevel.end(), 0);
+    std::stable_sort(byLevel.begin(), byLevel.end(), [&](qsizetype a, qsizetype b) {
+        return planned.at(a).first.count(QChar('/')) < planned.at(b).first.count(QChar('/'));
+    });
+    QHash<QString, QString> moved;
+    std::function<QString(const QString&)> relocate = [&](const QString& path) {
+        qsizetype separator = path.lastIndexOf(QChar('/'));
+        if (separator <= 0)
+            return path;
+        QString parent = path.left(separator);
+        return relocate(moved.value(parent, parent)) + path.mid(separator);
+    };
+    auto parked = [&](qsizetype i) {
+        foreach (const auto& temporary, temporaries.values(planned.at(i).first))
+            if (QFileInfo::exists(relocate(temporary)))
+                return temporary;
+        return QString();
+    };
+    // A cycle starts with its park, which is synced before anything else of
+    // it happens, so one without a trace on disk or in the journal is
+    // untouched.
+    QHash<qsizetype, bool> started;
+    auto isStarted = [&](qsizetype id) {
+        auto it = started.constFind(id);
+        if (it != started.cend())
+            return it.value();
+        bool result = false;
+        qsizetype k = id;
+        do
+        {
+            result = current.contains(planned.at(k).first) || !parked(k).isNull();
+            k = next.at(k);
+        }
+        while (!result && k != id);
+        started.insert(id, result);
+        return result;
+    };
+    // Where the file of a plan is now, or a null string when that cannot
+    // be told; the plan onto its source is located first.
+    QList<QString> at(planned.size());
+    QList<bool> located(planned.size(), false);
+    auto locate = [&](qsizetype i) {
+        const QString& source = planned.at(i).first;
+        const QString& target = planned.at(i).second;
+        if (current.contains(source))
+        {
+            // Only an unpark, the last step of a cycle, can be missing
+            // after a recorded step.
+            QString last = current.value(source);
+            if (!complete && temporaries.contains(source, last) && !QFileInfo::exists(relocate(last)) && QFileInfo::exists(relocate(target)))
+                return target;
+            return last;
+        }
+        if (complete)
+            return source;
+        QString temporary = parked(i);
+        if (!temporary.isNull())
+            return temporary;
+        // In a swap or a rotation every source is taken over as soon as it
+        // is left, so the files cannot tell which steps were done; only the
+        // journal can, and a step it misses is left to the user.
+        if (cycle.at(i) >= 0)
+            return isStarted(cycle.at(i)) ? QString() : source;
+        // Elsewhere renames done after the last sync were lost with the
+        // crash, and the files tell whether they happened: the source can
+        // only be taken over by the plan onto it, and nothing but this
+        // plan moves onto its target.
+        qsizetype p = previous.at(i);
+        bool kept = p < 0 || at.at(p) == planned.at(p).first;
+        bool takenOver = p >= 0 && at.at(p) == source;
+        if (kept && QFileInfo::exists(relocate(source)))
+            return source;
+        if ((kept || takenOver) && QFileInfo::exists(relocate(target)))
+            return target;
+        return QString();
+    };
+    foreach (qsizetype i, byLevel)
+    {
+        if (!located.at(i))
+        {
+            QList<qsizetype> chain(1, i);
+            if (cycle.at(i) < 0)
+                for (qsizetype p = previous.at(i); p >= 0 && !located.at(p); p = previous.at(p))
+                    chain.prepend(p);
+            foreach (qsizetype k, chain)
+            {
+                at[k] = locate(k);
+                located[k] = true;
+            }
+        }
+        const QPair<QString, QString>& rename = planned.at(i);
+        if (at.at(i).isNull())
+        {
+            qWarning() << "Cannot tell where " << rename.first << " is after the interrupted run";
+            if (unresolved)
+                unresolved->append(relocate(rename.first));
+            continue;
+        }
+        if (at.at(i) != rename.first)
+            moved.insert(rename.first, at.at(i));
+        const QString& target = recovery == RenameJournal::Finish ? rename.second : rename.first;
+        if (at.at(i) != target)
+            task.append(relocate(at.at(i)), QFileInfo(target).fileName());
+    }
+    return task;
+}
+
+void RenameJournal::write(char type, const QString& from, const QString& to)
+{
+    if (this->file.isOpen())
+        this->stream << quint8(type) << from << to;
+}
+
+QStringList RenameJournal::journals()
+{
+    QDir dir(RenameJournal::directory());
+    QStringList journals;
+    foreach (const auto& name, dir.entryList(QStringList("*.journal"), QDir::Files, QDir::Name | QDir::Reversed))
+        journals.append(dir.filePath(name));
+    return journals;
+}
@@ -0,0 +1,49 @@
+#ifndef RENAMEJOURNAL_H
+#define RENAMEJOURNAL_H
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QFile>
+#include <task.h>
+
+// Append-only, crash-safe record of a rename run. The planned renames are
+// written and synced before the first file is touched, a file parked to
+// break a cycle as two steps through its temporary name; every completed
+// rename is appended and synced in batches, the steps of a cycle one by
+// one, and an end marker closes a run that got to the end. A journal
+// without that marker belongs to an interrupted run and can be finished or
+// rolled back.
+class RenameJournal
+{
+    Q_DECLARE_TR_FUNCTIONS(RenameJournal)
+
+public:
+    enum Recovery {Finish, RollBack};
+    RenameJournal();
+    ~RenameJournal();
+    void close();
+    QString errorString() const;
+    QString fileName() const;
+    bool open();
+    void plan(const QString&, const QString&);
+    void planTemporary(const QString&, const QString&);
+    void record(const QString&, const QString&);
+    void sync();
+    static QStringList completed();
+    static QString directory();
+    static QStringList interrupted();
+    static bool isComplete(const QString&);
+    static Task recover(const QString&, Recovery, QStringList* = nullptr);
+
+private:
+    static constexpr qsizetype syncInterval = 1024;
+    static constexpr qsizetype keepCompleted = 10;
+    QFile file;
+    QDataStream stream;
+    QString error;
+    qsizetype unsynced;
+    void write(char, const QString&, const QString&);
+    static QStringList journals();
+};
+
+#endif // RENAMEJOURNAL_H
@@ -0,0 +1,195 @@
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QtTest>
+#include "renamejournal.h"
+#include "renamescheduler.h"
+
+// Writes journals of runs cut short at various points, lays the files out
+// as the crash left them, and checks what recover() would rename to
+// finish the run or to roll it back, and what it leaves to the user.
+
+class RenameJournalTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void chainFollowedOnDisk();
+    void completeTrustsJournal();
+    void cycleNotStarted();
+    void cycleUnparkLost();
+    void cycleUnrecordedStep();
+    void init();
+    void initTestCase();
+    void recordedSteps();
+
+private:
+    QTemporaryDir dir;
+    QString path(const QString&) const;
+    QStringList recover(const QString&, RenameJournal::Recovery, QStringList* = nullptr) const;
+    void touch(const QStringList&) const;
+};
+
+void RenameJournalTest::chainFollowedOnDisk()
+{
+    // b -> c was recorded; a -> b happened but was lost with the crash.
+    QString journal;
+    {
+        RenameJournal run;
+        QVERIFY(run.open());
+        run.plan(this->path("b"), this->path("c"));
+        run.plan(this->path("a"), this->path("b"));
+        run.sync();
+        run.record(this->path("b"), this->path("c"));
+        journal = run.fileName();
+    }
+    this->touch({"b", "c"});
+    QVERIFY(!RenameJournal::isComplete(journal));
+    QCOMPARE(this->recover(journal, RenameJournal::Finish), QStringList());
+    QCOMPARE(this->recover(journal, RenameJournal::RollBack), QStringList({"b > a", "c > b"}));
+}
+
+void RenameJournalTest::completeTrustsJournal()
+{
+    QString journal;
+    {
+        RenameJournal run;
+        QVERIFY(run.open());
+        run.plan(this->path("a"), this->path("b"));
+        run.plan(this->path("c"), this->path("d"));
+        run.record(this->path("a"), this->path("b"));
+        run.record(this->path("c"), this->path("d"));
+        journal = run.fileName();
+        run.close();
+    }
+    QVERIFY(RenameJournal::isComplete(journal));
+    QCOMPARE(RenameJournal::completed(), QStringList(journal));
+    QCOMPARE(this->recover(journal, RenameJournal::Finish), QStringList());
+    QCOMPARE(this->recover(journal, RenameJournal::RollBack), QStringList({"b > a", "d > c"}));
+}
+
+void RenameJournalTest::cycleNotStarted()
+{
+    // A swap planned through a temporary name, cut short before its park.
+    QString temporary = RenameScheduler::temporaryName(0, 0);
+    QString journal;
+    {
+        RenameJournal run;
+        QVERIFY(run.open());
+        run.planTemporary(this->path("x"), this->path(temporary));
+        run.plan(this->path(temporary), this->path("y"));
+        run.plan(this->path("y"), this->path("x"));
+        journal = run.fileName();
+    }
+    this->touch({"x", "y"});
+    QStringList unresolved;
+    QCOMPARE(this->recover(journal, RenameJournal::Finish, &unresolved), QStringList({"x > y", "y > x"}));
+    QCOMPARE(unresolved, QStringList());
+    QCOMPARE(this->recover(journal, RenameJournal::RollBack), QStringList());
+}
+
+void RenameJournalTest::cycleUnparkLost()
+{
+    // Every step of the swap was done, the last one was not recorded.
+    QString temporary = RenameScheduler::temporaryName(0, 0);
+    QString journal;
+    {
+        RenameJournal run;
+        QVERIFY(run.open());
+        run.planTemporary(this->path("x"), this->path(temporary));
+        run.plan(this->path(temporary), this->path("y"));
+        run.plan(this->path("y"), this->path("x"));
+        run.record(this->path("x"), this->path(temporary));
+        run.record(this->path("y"), this->path("x"));
+        journal = run.fileName();
+    }
+    this->touch({"x", "y"});
+    QCOMPARE(this->recover(journal, RenameJournal::Finish), QStringList());
+    QCOMPARE(this->recover(journal, RenameJournal::RollBack), QStringList({"x > y", "y > x"}));
+}
+
+void RenameJournalTest::cycleUnrecordedStep()
+{
+    // x was parked, then y moved onto x without a record: the files cannot
+    // tell that step apart from one not done, so y is left to the user.
+    QString temporary = RenameScheduler::temporaryName(0, 0);
+    QString journal;
+    {
+        RenameJournal run;
+        QVERIFY(run.open());
+        run.planTemporary(this->path("x"), this->path(temporary));
+        run.plan(this->path(temporary), this->path("y"));
+        run.plan(this->path("y"), this->path("x"));
+        run.record(this->path("x"), this->path(temporary));
+        journal = run.fileName();
+    }
+    this->touch({temporary, "x"});
+    QStringList unresolved;
+    QCOMPARE(this->recover(journal, RenameJournal::Finish, &unresolved), QStringList({temporary + " > y"}));
+    QCOMPARE(unresolved, QStringList(this->path("y")));
+}
+
+void RenameJournalTest::init()
+{
+    QDir(RenameJournal::directory()).removeRecursively();
+    foreach (const auto& name, QDir(this->dir.path()).entryList(QDir::Files | QDir::Hidden))
+        QFile::remove(this->path(name));
+}
+
+void RenameJournalTest::initTestCase()
+{
+    // Journals go to a directory of their own for the test.
+    QStandardPaths::setTestModeEnabled(true);
+    QVERIFY(this->dir.isValid());
+}
+
+void RenameJournalTest::recordedSteps()
+{
+    // a -> b was recorded, c -> d never started.
+    QString journal;
+    {
+        RenameJournal run;
+        QVERIFY(run.open());
+        run.plan(this->path("a"), this->path("b"));
+        run.plan(this->path("c"), this->path("d"));
+        run.sync();
+        run.record(this->path("a"), this->path("b"));
+        journal = run.fileName();
+    }
+    this->touch({"b", "c"});
+    QCOMPARE(RenameJournal::interrupted(), QStringList(journal));
+    QCOMPARE(this->recover(journal, RenameJournal::Finish), QStringList({"c > d"}));
+    QCOMPARE(this->recover(journal, RenameJournal::RollBack), QStringList({"b > a"}));
+}
+
+QString RenameJournalTest::path(const QString& name) const
+{
+    return this->dir.filePath(name);
+}
+
+QStringList RenameJournalTest::recover(const QString& journal, RenameJournal::Recovery recovery, QStringList* unresolved) const
+{
+    // The renames of the recovered task, as "from > to" relative to the
+    // directory, sorted.
+    Task task = RenameJournal::recover(journal, recovery, unresolved);
+    QDir base(this->dir.path());
+    QStringList renames;
+    for (qsizetype i = 0; i < task.size(); ++i)
+        renames.append(base.relativeFilePath(task.filePath(i, 0)) + " > " + task.fileName(i, task.depth(i) - 1));
+    renames.sort();
+    return renames;
+}
+
+void RenameJournalTest::touch(const QStringList& names) const
+{
+    foreach (const auto& name, names)
+    {
+        QFile file(this->path(name));
+        file.open(QIODevice::WriteOnly);
+    }
+}
+
+QTEST_GUILESS_MAIN(RenameJournalTest)
+
+#include "renamejournaltest.moc"
@@ -0,0 +1,860 @@
+#include <QDateTime>
+#include <QtConcurrent/QtConcurrentMap>
+#include <algorithm>
+#include <limits>
+#include "codepointindex.h"
+#include "metadatacache.h"
+#include "renameplan.h"
+#include "trace.h"
+
+static constexpr qsizetype keyChunkSize = 4096;
+
+RenamePlan::RenamePlan()
+{
+}
+
+RenamePlan::RenamePlan(Task::Mask mask, Task::Rule rule, const QList<QString>& strings, const QList<int>& numbers)
+{
+    Step step;
+    step.mask = mask;
+    step.rule = rule;
+    this->compile(step, strings, numbers);
+    if (this->error.isEmpty())
+        this->steps.append(step);
+}
+
+RenamePlan::Step::Step()
+    : mask(Task::ExtExcluded)
+    , rule(Task::Rename)
+    , kernel(nullptr)
+    , caseSensitivity(Qt::CaseSensitive)
+    , task(nullptr)
+    , plainPrefix(true)
+    , order(RenamePlan::DropOrder)
+    , ordinal(0)
+    , digits(0)
+    , modulus(1)
+    , offset(0)
+    , count(0)
+    , form(QString::NormalizationForm_C)
+    , letterCase(UnicodeForm::LowerCase)
+{
+}
+
+void RenamePlan::append(const RenamePlan& next)
+{
+    // A chain is only as valid as its worst rule; the first error wins.
+    if (this->error.isEmpty())
+        this->error = next.error;
+    this->steps += next.steps;
+}
+
+bool RenamePlan::apply(QStringView fileName, qsizetype index, QString& modFileName) const
+{
+    if (!this->isValid())
+        return false;
+    // Every rule rewrites the same buffer in place; resize() keeps its
+    // capacity from one file to the next.
+    modFileName.resize(0);
+    modFileName += fileName;
+    foreach (const auto& step, this->steps)
+        step.apply(modFileName, index);
+    return true;
+}
+
+void RenamePlan::appendNumber(QString& text, qint64 value, int width)
+{
+    // Digits go through a small array instead of QString::number().
+    char16_t digits[20];
+    int size = 0;
+    quint64 magnitude = value < 0 ? 0 - quint64(value) : quint64(value);
+    do
+    {
+        digits[size++] = char16_t(u'0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+        text += QChar('-');
+    for (int i = size; i < width; ++i)
+        text += QChar('0');
+    while (size)
+        text += QChar(digits[--size]);
+}
+
+void RenamePlan::bind(const Task& task)
+{
+    // Steps sorting the same way share one ranking. A template only gets
+    // the metadata its fields read.
+    QHash<int, QList<qsizetype>> rankings;
+    for (QList<Step>::iterator step = this->steps.begin(); step < this->steps.end(); ++step)
+    {
+        if (step->rule == Task::Template)
+        {
+            step->task = &task;
+            foreach (const auto& instruction, step->program)
+                if ((instruction.token == RenamePlan::Size || instruction.token == RenamePlan::Date) && step->metadata[instruction.field].size() != task.size())
+                    step->metadata[instruction.field] = task.metadata().fetch(task, instruction.field);
+        }
+        if (step->order == RenamePlan::DropOrder)
+            continue;
+        if (!rankings.contains(step->order))
+            rankings.insert(step->order, RenamePlan::rank(task, step->order));
+        step->ranks = rankings.value(step->order);
+    }
+}
+
+void RenamePlan::Step::apply(QString& fileName, qsizetype index) const
+{
+    // A template writes the whole name, suffix and all, in place.
+    if (this->rule == Task::Template)
+    {
+        this->kernel(*this, fileName, index);
+        return;
+    }
+    // Same split as QFileInfo::completeBaseName() and QFileInfo::suffix().
+    qsizetype dot = fileName.lastIndexOf(QChar('.'));
+    qsizetype begin;
+    qsizetype end;
+    if (this->mask == Task::ExtExcluded)
+    {
+        begin = 0;
+        end = dot < 0 ? fileName.size() : dot;
+    }
+    else
+    {
+        begin = dot < 0 ? fileName.size() : dot + 1;
+        end = fileName.size();
+    }
+    QString modText = fileName.mid(begin, end - begin);
+    this->kernel(*this, modText, index);
+    // A name without a suffix only gets a dot when a suffix is added.
+    if (this->mask == Task::ExtOnly && dot < 0)
+    {
+        if (!modText.isEmpty())
+        {
+            fileName += QChar('.');
+            fileName += modText;
+        }
+        return;
+    }
+    fileName.replace(begin, end - begin, modText);
+}
+
+QString RenamePlan::errorString() const
+{
+    if (this->error.isEmpty() && this->steps.isEmpty())
+        return tr("沒有指定改名邏輯。");
+    return this->error;
+}
+
+Task::Mask RenamePlan::getMask() const
+{
+    return this->steps.isEmpty() ? Task::ExtExcluded : this->steps.first().mask;
+}
+
+Task::Rule RenamePlan::getRule() const
+{
+    return this->steps.isEmpty() ? Task::Rename : this->steps.first().rule;
+}
+
+bool RenamePlan::isValid() const
+{
+    return !this->steps.isEmpty() && this->error.isEmpty();
+}
+
+qsizetype RenamePlan::size() const
+{
+    return this->steps.size();
+}
+
+void RenamePlan::changeCase(const Step& step, QString& modText, qsizetype)
+{
+    UnicodeForm::changeCase(modText, step.letterCase);
+}
+
+void RenamePlan::compile(Step& step, const QList<QString>& strings, const QList<int>& numbers)
+{
+    switch (step.mask)
+    {
+        case Task::ExtExcluded:
+        case Task::ExtOnly:
+        break;
+        default:
+            this->error = tr("沒有這種改名範圍：%1").arg(int(step.mask));
+        return;
+    }
+    switch (step.rule)
+    {
+        case Task::Rename:
+            if (strings.size() != 1)
+            {
+                this->error = tr("直接改名需要一個新檔名。");
+                return;
+            }
+            step.text = strings.at(0);
+            step.kernel = &RenamePlan::rename;
+        break;
+        case Task::OrdinalWithPrefix:
+        case Task::OrdinalWithPrefixReverse:
+        {
+            if (strings.size() != 2)
+            {
+                this->error = tr("文字 + 序號需要文字和序號。");
+                return;
+            }
+            bool ok;
+            QString ordinal = strings.at(1).trimmed();
+            step.ordinal = ordinal.toInt(&ok);
+            if (ordinal.size() >= QString::number(INT_MAX).size())
+                ok = false;
+            if (!ok)
+            {
+                this->error = tr("序號無效：%1").arg(ordinal);
+                return;
+            }
+            if (!this->compileOrder(step, numbers))
+                return;
+            step.text = strings.at(0);
+            // A prefix with its own %-markers has to go through QString::arg()
+            // like before, so that it expands the same way.
+            step.plainPrefix = !step.text.contains(QChar('%'));
+            step.digits = ordinal.size();
+            step.modulus = 1;
+            for (int i = 0; i < step.digits; ++i)
+                step.modulus *= 10;
+            if (step.rule == Task::OrdinalWithPrefix)
+                step.kernel = &RenamePlan::ordinalWithPrefix;
+            else
+                step.kernel = &RenamePlan::ordinalWithPrefixReverse;
+        }
+        break;
+        case Task::Replace:
+        {
+            if (strings.size() != 2 || numbers.size() > 1)
+            {
+                this->error = tr("取代需要原文字和新文字。");
+                return;
+            }
+            int flags = numbers.isEmpty() ? 0 : numbers.at(0);
+            step.text = strings.at(0);
+            step.replacement = strings.at(1);
+            step.caseSensitivity = flags & RenamePlan::CaseInsensitive ? Qt::CaseInsensitive : Qt::CaseSensitive;
+            if (flags & RenamePlan::RegularExpression)
+            {
+                QRegularExpression::PatternOptions options = QRegularExpression::UseUnicodePropertiesOption;
+                if (flags & RenamePlan::CaseInsensitive)
+                    options |= QRegularExpression::CaseInsensitiveOption;
+                step.regex = QRegularExpression(step.text, options);
+                if (!step.regex.isValid())
+                {
+                    this->error = tr("正規表示式無效：%1").arg(step.regex.errorString());
+                    return;
+                }
+                // Compiled (and JIT-compiled where available) here, once,
+                // instead of lazily by the first worker thread that matches.
+                step.regex.optimize();
+                RenamePlan::compileReplacement(step);
+                step.kernel = &RenamePlan::replaceRegex;
+            }
+            else if (step.text.size() >= RenamePlan::minMatcherPattern)
+            {
+                // Long patterns are searched with a precomputed skip table;
+                // short ones do better with QString's own search.
+                step.matcher = QStringMatcher(step.text, step.caseSensitivity);
+                step.kernel = &RenamePlan::replaceMatcher;
+            }
+            else
+            {
+                step.kernel = &RenamePlan::replace;
+            }
+        }
+        break;
+        case Task::Insert:
+        case Task::InsertLast:
+            if (strings.size() != 1 || numbers.size() != 1)
+            {
+                this->error = tr("插入需要文字和位置。");
+                return;
+            }
+            step.text = strings.at(0);
+            step.offset = numbers.at(0);
+            if (step.rule == Task::Insert)
+                step.kernel = &RenamePlan::insertFirst;
+            else
+                step.kernel = &RenamePlan::insertLast;
+        break;
+        case Task::Delete:
+        case Task::DeleteLast:
+            if (numbers.size() != 2)
+            {
+                this->error = tr("刪除需要位置和字數。");
+                return;
+            }
+            step.offset = numbers.at(0);
+            step.count = numbers.at(1);
+            if (step.rule == Task::Delete)
+                step.kernel = &RenamePlan::deleteFirst;
+            else
+                step.kernel = &RenamePlan::deleteLast;
+        break;
+        case Task::ToUnicode:
+        case Task::ToLocale:
+            if (strings.size() != 1)
+            {
+                this->error = tr("字碼轉換需要代碼頁。");
+                return;
+            }
+            step.codePage = CodePage(strings.at(0));
+            if (!step.codePage.isValid())
+            {
+                this->error = tr("不支援的代碼頁：%1").arg(strings.at(0));
+                return;
+            }
+            if (step.rule == Task::ToUnicode)
+                step.kernel = &RenamePlan::toUnicode;
+            else
+                step.kernel = &RenamePlan::toLocale;
+        break;
+        case Task::Template:
+            if (strings.size() != 1)
+            {
+                this->error = tr("樣板改名需要一個樣板。");
+                return;
+            }
+            if (!this->compileOrder(step, numbers))
+                return;
+            this->compileTemplate(step, strings.at(0));
+            step.kernel = &RenamePlan::renderTemplate;
+        break;
+        case Task::Normalize:
+            if (numbers.size() != 1 || numbers.at(0) < QString::NormalizationForm_D || numbers.at(0) > QString::NormalizationForm_KC)
+            {
+                this->error = tr("正規化需要 NFD、NFC、NFKD 或 NFKC 其中一種形式。");
+                return;
+            }
+            step.form = QString::NormalizationForm(numbers.at(0));
+            step.kernel = &RenamePlan::normalize;
+        break;
+        case Task::ChangeCase:
+            if (numbers.size() != 1 || numbers.at(0) < UnicodeForm::UpperCase || numbers.at(0) > UnicodeForm::TitleCase)
+            {
+                this->error = tr("大小寫轉換需要大寫、小寫或字首大寫其中一種。");
+                return;
+            }
+            step.letterCase = UnicodeForm::Case(numbers.at(0));
+            step.kernel = &RenamePlan::changeCase;
+        break;
+        default:
+            this->error = tr("沒有這種改名邏輯：%1").arg(int(step.rule));
+        return;
+    }
+}
+
+bool RenamePlan::compileOrder(Step& step, const QList<int>& numbers)
+{
+    if (numbers.size() > 1 || (numbers.size() == 1 && (numbers.at(0) < RenamePlan::DropOrder || numbers.at(0) > RenamePlan::ByCreated)))
+    {
+        this->error = tr("沒有這種排序方式。");
+        return false;
+    }
+    step.order = numbers.isEmpty() ? RenamePlan::DropOrder : RenamePlan::Order(numbers.at(0));
+    return true;
+}
+
+void RenamePlan::compileReplacement(Step& step)
+{
+    // Backreferences follow QString::replace(const QRegularExpression&):
+    // \1 to \99, taking a second digit only while it names a group; \0
+    // is not one and stays literal.
+    int groups = step.regex.captureCount();
+    Piece literal;
+    literal.group = -1;
+    const QString& after = step.replacement;
+    for (qsizetype i = 0; i < after.size(); ++i)
+    {
+        int group = -1;
+        qsizetype next = i;
+        if (after.at(i) == QChar('\\') && i + 1 < after.size() && after.at(i + 1).digitValue() > 0)
+        {
+            group = after.at(i + 1).digitValue();
+            next = i + 1;
+            if (i + 2 < after.size() && after.at(i + 2).isDigit())
+            {
+                int twoDigits = group * 10 + after.at(i + 2).digitValue();
+                if (twoDigits <= groups)
+                {
+                    group = twoDigits;
+                    next = i + 2;
+                }
+            }
+        }
+        if (group < 0 || group > groups)
+        {
+            literal.text += after.at(i);
+            continue;
+        }
+        if (!literal.text.isEmpty())
+        {
+            step.pieces.append(literal);
+            literal.text.clear();
+        }
+        Piece backreference;
+        backreference.group = group;
+        step.pieces.append(backreference);
+        i = next;
+    }
+    if (!literal.text.isEmpty())
+        step.pieces.append(literal);
+}
+
+void RenamePlan::compileTemplate(Step& step, const QString& pattern)
+{
+    // The pattern is parsed once into a flat program; literal runs are
+    // gathered into the step's text, and a date format becomes one
+    // instruction per field.
+    static const struct
+    {
+        const char16_t* name;
+        Order order;
+    } counterOrders[] = {{u"name", RenamePlan::ByName}, {u"mtime", RenamePlan::ByModified}, {u"size", RenamePlan::BySize}, {u"btime", RenamePlan::ByCreated}};
+    auto make = [](Token token) {
+        Instruction instruction;
+        instruction.token = token;
+        instruction.field = MetadataCache::Modified;
+        instruction.date = 0;
+        instruction.offset = 0;
+        instruction.length = 0;
+        instruction.width = 0;
+        return instruction;
+    };
+    auto literal = [&step, &make](QStringView text) {
+        if (text.isEmpty())
+            return;
+        if (step.program.isEmpty() || step.program.last().token != RenamePlan::Literal)
+        {
+            Instruction instruction = make(RenamePlan::Literal);
+            instruction.offset = step.text.size();
+            step.program.append(instruction);
+        }
+        step.program.last().length += text.size();
+        step.text += text;
+    };
+    auto width = [this](QStringView spec, int& value) {
+        bool ok = true;
+        value = spec.isEmpty() ? 0 : spec.toInt(&ok);
+        if (!ok || value < 0 || value > 32)
+        {
+            this->error = tr("樣板欄位寬度無效：%1").arg(spec);
+            return false;
+        }
+        return true;
+    };
+    step.text.clear();
+    QStringView rest(pattern);
+    while (!rest.isEmpty())
+    {
+        if (rest.startsWith(u"{{") || rest.startsWith(u"}}"))
+        {
+            literal(rest.left(1));
+            rest = rest.mid(2);
+            continue;
+        }
+        if (rest.front() == QChar('}'))
+        {
+            this->error = tr("樣板中的 } 沒有對應的 {，要寫 } 本身請用 }}。");
+            return;
+        }
+        if (rest.front() != QChar('{'))
+        {
+            qsizetype next = 1;
+            while (next < rest.size() && rest.at(next) != QChar('{') && rest.at(next) != QChar('}'))
+                ++next;
+            literal(rest.left(next));
+            rest = rest.mid(next);
+            continue;
+        }
+        qsizetype close = rest.indexOf(QChar('}'));
+        if (close < 0)
+        {
+            this->error = tr("樣板中的 { 沒有對應的 }，要寫 { 本身請用 {{。");
+            return;
+        }
+        QStringView field = rest.mid(1, close - 1);
+        rest = rest.mid(close + 1);
+        qsizetype colon = field.indexOf(QChar(':'));
+        QStringView name = colon < 0 ? field : field.left(colon);
+        QStringView spec = colon < 0 ? QStringView() : field.mid(colon + 1);
+        if (name == u"name" || name == u"ext" || name == u"parent")
+        {
+            if (!spec.isEmpty())
+            {
+                this->error = tr("樣板欄位 {%1} 不接受格式。").arg(name);
+                return;
+            }
+            step.program.append(make(name == u"name" ? RenamePlan::BaseName : name == u"ext" ? RenamePlan::Suffix : RenamePlan::Parent));
+        }
+        else if (name == u"n")
+        {
+            // {n:04:name} numbers by name, and so on; the order given in
+            // the template wins over the plan's.
+            Instruction instruction = make(RenamePlan::Counter);
+            colon = spec.indexOf(QChar(':'));
+            if (!width(colon < 0 ? spec : spec.left(colon), instruction.width))
+                return;
+            if (colon >= 0)
+            {
+                QStringView orderName = spec.mid(colon + 1);
+                bool found = false;
+                for (const auto& o : counterOrders)
+                {
+                    if (orderName == QStringView(o.name))
+                    {
+                        step.order = o.order;
+                        found = true;
+                    }
+                }
+                if (!found)
+                {
+                    this->error = tr("沒有這種排序方式：%1").arg(orderName);
+                    return;
+                }
+            }
+            step.program.append(instruction);
+        }
+        else if (name == u"size")
+        {
+            Instruction instruction = make(RenamePlan::Size);
+            instruction.field = MetadataCache::Size;
+            if (!width(spec, instruction.width))
+                return;
+            step.program.append(instruction);
+        }
+        else if (name == u"mtime" || name == u"btime")
+        {
+            MetadataCache::Field source = name == u"mtime" ? MetadataCache::Modified : MetadataCache::Created;
+            QStringView format = spec.isEmpty() ? QStringView(u"%Y%m%d") : spec;
+            for (qsizetype i = 0; i < format.size(); ++i)
+            {
+                if (format.at(i) != QChar('%') || i + 1 == format.size())
+                {
+                    literal(format.mid(i, 1));
+                    continue;
+                }
+                char16_t c = format.at(++i).unicode();
+                if (c == u'%')
+                {
+                    literal(format.mid(i, 1));
+                    continue;
+                }
+                if (c != u'Y' && c != u'm' && c != u'd' && c != u'H' && c != u'M' && c != u'S')
+                {
+                    this->error = tr("日期格式不支援 %%1。").arg(QChar(c));
+                    return;
+                }
+                Instruction instruction = make(RenamePlan::Date);
+                instruction.field = source;
+                instruction.date = c;
+                instruction.width = c == u'Y' ? 4 : 2;
+                step.program.append(instruction);
+            }
+        }
+        else
+        {
+            this->error = tr("樣板中沒有這種欄位：{%1}").arg(name);
+            return;
+        }
+    }
+    if (step.program.isEmpty())
+        this->error = tr("樣板是空的。");
+}
+
+void RenamePlan::formatOrdinal(const Step& step, QString& modText, int suffix)
+{
+    if (suffix < 0)
+        suffix = (suffix % step.modulus + step.modulus) % step.modulus;
+    if (step.plainPrefix)
+    {
+        QString number = QString::number(suffix);
+        modText = step.text;
+        modText.reserve(step.text.size() + qMax(qsizetype(step.digits), number.size()));
+        for (qsizetype i = number.size(); i < step.digits; ++i)
+            modText += QChar('0');
+        modText += number;
+    }
+    else
+    {
+        modText = QString("%1%2").arg(step.text).arg(suffix, step.digits, 10, QChar('0'));
+    }
+}
+
+// The positional rules count code points like the UTF-8 round trip they
+// used to make, but seek on the UTF-16 text directly. Positions past either
+// end of the name count one per step in both encodings, so the padding and
+// clamping come out the same.
+static qsizetype seek(const QString& text, qsizetype base, qsizetype offset)
+{
+    return CodePointIndex::seekUtf16(reinterpret_cast<const char16_t*>(text.utf16()), text.size(), base, offset);
+}
+
+void RenamePlan::deleteFirst(const Step& step, QString& modText, qsizetype)
+{
+    qsizetype begin = seek(modText, 0, step.offset);
+    qsizetype end = seek(modText, begin, step.count);
+    modText.remove(begin, end - begin);
+}
+
+void RenamePlan::deleteLast(const Step& step, QString& modText, qsizetype)
+{
+    qsizetype end = seek(modText, modText.size(), 0 - step.offset);
+    qsizetype begin = seek(modText, end, 0 - step.count);
+    if (begin < 0)
+        begin = 0;
+    modText.remove(begin, end - begin);
+}
+
+void RenamePlan::insertFirst(const Step& step, QString& modText, qsizetype)
+{
+    modText.insert(seek(modText, 0, step.offset), step.text);
+}
+
+void RenamePlan::insertLast(const Step& step, QString& modText, qsizetype)
+{
+    qsizetype pos = seek(modText, modText.size(), 0 - step.offset);
+    if (pos < 0)
+        modText.prepend(QString(0 - pos, QChar(' '))).prepend(step.text);
+    else
+        modText.insert(pos, step.text);
+}
+
+QString RenamePlan::naturalKey(QStringView name)
+{
+    // A run of digits becomes a marker below any printable character, its
+    // length without leading zeros and those digits, so that comparing
+    // keys puts "2" before "10" and numbers before letters; the rest is
+    // case-folded.
+    QString key;
+    key.reserve(name.size() + 4);
+    for (qsizetype i = 0; i < name.size();)
+    {
+        char16_t c = name.at(i).unicode();
+        if (c < u'0' || c > u'9')
+        {
+            key += name.at(i).toCaseFolded();
+            ++i;
+            continue;
+        }
+        qsizetype begin = i;
+        while (i < name.size() && name.at(i).unicode() >= u'0' && name.at(i).unicode() <= u'9')
+            ++i;
+        while (begin < i - 1 && name.at(begin) == QChar('0'))
+            ++begin;
+        key += QChar(0x1);
+        key += QChar(char16_t(qMin(i - begin, qsizetype(0xffff))));
+        key += name.mid(begin, i - begin);
+    }
+    return key;
+}
+
+void RenamePlan::normalize(const Step& step, QString& modText, qsizetype)
+{
+    UnicodeForm::normalize(modText, step.form);
+}
+
+void RenamePlan::ordinalWithPrefix(const Step& step, QString& modText, qsizetype index)
+{
+    RenamePlan::formatOrdinal(step, modText, step.ordinal + int(RenamePlan::position(step, index)));
+}
+
+void RenamePlan::ordinalWithPrefixReverse(const Step& step, QString& modText, qsizetype index)
+{
+    RenamePlan::formatOrdinal(step, modText, step.ordinal - int(RenamePlan::position(step, index)));
+}
+
+qsizetype RenamePlan::position(const Step& step, qsizetype index)
+{
+    return index < step.ranks.size() ? step.ranks.at(index) : index;
+}
+
+QList<qsizetype> RenamePlan::rank(const Task& task, Order order)
+{
+    // Every item gets its sort key up front, names in parallel, and the
+    // keys are sorted next to their indexes, which also keep ties in drop
+    // order; the comparisons never go back to the task.
+    Trace::Span span("rankItems");
+    qsizetype size = task.size();
+    QList<qsizetype> ranks(size);
+    if (order == RenamePlan::ByName)
+    {
+        QList<QPair<QString, qsizetype>> keys(size);
+        QList<qsizetype> chunks;
+        for (qsizetype chunk = 0; chunk < size; chunk += keyChunkSize)
+            chunks.append(chunk);
+        QPair<QString, qsizetype>* data = keys.data();
+        QtConcurrent::blockingMap(chunks, [&task, size, data](qsizetype chunk) {
+            qsizetype end = qMin(chunk + keyChunkSize, size);
+            for (qsizetype i = chunk; i < end; ++i)
+                data[i] = qMakePair(RenamePlan::naturalKey(task.fileNameView(i, 0)), i);
+        });
+        std::sort(keys.begin(), keys.end());
+        for (qsizetype r = 0; r < size; ++r)
+            ranks[keys.at(r).second] = r;
+    }
+    else
+    {
+        MetadataCache::Field field = order == RenamePlan::BySize ? MetadataCache::Size : order == RenamePlan::ByCreated ? MetadataCache::Created : MetadataCache::Modified;
+        QList<qint64> values = task.metadata().fetch(task, field);
+        QList<QPair<qint64, qsizetype>> keys(size);
+        for (qsizetype i = 0; i < size; ++i)
+            keys[i] = qMakePair(values.at(i), i);
+        std::sort(keys.begin(), keys.end());
+        for (qsizetype r = 0; r < size; ++r)
+            ranks[keys.at(r).second] = r;
+    }
+    return ranks;
+}
+
+void RenamePlan::rename(const Step& step, QString& modText, qsizetype)
+{
+    modText = step.text;
+}
+
+void RenamePlan::renderTemplate(const Step& step, QString& fileName, qsizetype index)
+{
+    // The incoming name is swapped into a buffer of this thread and the
+    // new one is written over the old; both keep their capacity, so from
+    // the second name on, nothing is allocated.
+    thread_local QString source;
+    source.swap(fileName);
+    fileName.resize(0);
+    QStringView name(source);
+    qsizetype dot = name.lastIndexOf(QChar('.'));
+    QDateTime times[MetadataCache::FieldCount];
+    for (qsizetype i = 0; i < step.program.size(); ++i)
+    {
+        const Instruction& instruction = step.program.at(i);
+        switch (instruction.token)
+        {
+            case RenamePlan::Literal:
+                fileName += QStringView(step.text).mid(instruction.offset, instruction.length);
+            break;
+            case RenamePlan::BaseName:
+                fileName += dot < 0 ? name : name.left(dot);
+            break;
+            case RenamePlan::Suffix:
+                if (dot >= 0)
+                    fileName += name.mid(dot);
+            break;
+            case RenamePlan::Parent:
+                if (step.task)
+                {
+                    QStringView prefix(step.task->begin()[index].dirPrefix());
+                    if (!prefix.isEmpty())
+                        prefix.chop(1);
+                    fileName += prefix.mid(prefix.lastIndexOf(QChar('/')) + 1);
+                }
+            break;
+            case RenamePlan::Counter:
+                RenamePlan::appendNumber(fileName, RenamePlan::position(step, index) + 1, instruction.width);
+            break;
+            case RenamePlan::Size:
+            case RenamePlan::Date:
+            {
+                // Unreadable metadata leaves its field empty.
+                const QList<qint64>& values = step.metadata[instruction.field];
+                qint64 value = index < values.size() ? values.at(index) : std::numeric_limits<qint64>::max();
+                if (value == std::numeric_limits<qint64>::max())
+                    break;
+                if (instruction.token == RenamePlan::Size)
+                {
+                    RenamePlan::appendNumber(fileName, value, instruction.width);
+                    break;
+                }
+                QDateTime& time = times[instruction.field];
+                if (!time.isValid())
+                    time = QDateTime::fromMSecsSinceEpoch(value / 1000000);
+                int field;
+                switch (instruction.date)
+                {
+                    case u'Y':
+                        field = time.date().year();
+                    break;
+                    case u'm':
+                        field = time.date().month();
+                    break;
+                    case u'd':
+                        field = time.date().day();
+                    break;
+                    case u'H':
+                        field = time.time().hour();
+                    break;
+                    case u'M':
+                        field = time.time().minute();
+                    break;
+                    default:
+                        field = time.time().second();
+                    break;
+                }
+                RenamePlan::appendNumber(fileName, field, instruction.width);
+            }
+            break;
+        }
+    }
+}
+
+void RenamePlan::replace(const Step& step, QString& modText, qsizetype)
+{
+    if (!step.text.isEmpty())
+        modText.replace(step.text, step.replacement, step.caseSensitivity);
+}
+
+void RenamePlan::replaceMatcher(const Step& step, QString& modText, qsizetype)
+{
+    qsizetype pos = step.matcher.indexIn(modText, 0);
+    if (pos < 0)
+        return;
+    QString result;
+    qsizetype last = 0;
+    qsizetype length = step.text.size();
+    for (; pos >= 0; pos = step.matcher.indexIn(modText, last))
+    {
+        result += QStringView(modText).mid(last, pos - last);
+        result += step.replacement;
+        last = pos + length;
+    }
+    result += QStringView(modText).mid(last);
+    modText = result;
+}
+
+void RenamePlan::replaceRegex(const Step& step, QString& modText, qsizetype)
+{
+    QRegularExpressionMatchIterator it = step.regex.globalMatch(modText);
+    if (!it.hasNext())
+        return;
+    QString result;
+    qsizetype last = 0;
+    while (it.hasNext())
+    {
+        QRegularExpressionMatch match = it.next();
+        result += QStringView(modText).mid(last, match.capturedStart() - last);
+        foreach (const auto& piece, step.pieces)
+        {
+            if (piece.group < 0)
+                result += piece.text;
+            else
+                result += match.capturedView(piece.group);
+        }
+        last = match.capturedEnd();
+    }
+    result += QStringView(modText).mid(last);
+    modText = result;
+}
+
+void RenamePlan::toLocale(const Step& step, QString& modText, qsizetype)
+{
+    step.codePage.toLocale(modText);
+}
+
+void RenamePlan::toUnicode(const Step& step, QString& modText, qsizetype)
+{
+    step.codePage.toUnicode(modText);
+}
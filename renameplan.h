@@ -0,0 +1,124 @@
+#ifndef RENAMEPLAN_H
+#define RENAMEPLAN_H
+
+#include <QCoreApplication>
+#include <QRegularExpression>
+#include <QStringMatcher>
+#include <codepage.h>
+#include <metadatacache.h>
+#include <task.h>
+#include <unicodeform.h>
+
+// A chain of rename rules validated and precomputed once per run. apply()
+// only does the per-file string transforms, through the kernels chosen for
+// the rules when the plan was compiled, one after another on the same
+// name, so a chain still costs a single pass and a single rename per file.
+// What depends on the whole task, the order of sorted ordinal rules, is
+// worked out once by bind(), which has to come before apply().
+class RenamePlan
+{
+    Q_DECLARE_TR_FUNCTIONS(RenamePlan)
+
+public:
+    // Options of the Replace rule, passed as its only number.
+    enum ReplaceFlag {RegularExpression = 0x1, CaseInsensitive = 0x2};
+    // What the ordinal rules number items by, passed as their only number;
+    // drop order is the default.
+    enum Order {DropOrder, ByName, ByModified, BySize, ByCreated};
+    // Normalize takes a QString::NormalizationForm and ChangeCase a
+    // UnicodeForm::Case as their only number.
+    RenamePlan();
+    RenamePlan(Task::Mask, Task::Rule, const QList<QString>&, const QList<int>&);
+    void append(const RenamePlan&);
+    bool apply(QStringView, qsizetype, QString&) const;
+    void bind(const Task&);
+    QString errorString() const;
+    Task::Mask getMask() const;
+    Task::Rule getRule() const;
+    bool isValid() const;
+    qsizetype size() const;
+
+private:
+    struct Step;
+    typedef void (*Kernel)(const Step&, QString&, qsizetype);
+    // A piece of a regular-expression replacement: literal text, or the
+    // capture group a backreference stands for.
+    struct Piece
+    {
+        QString text;
+        int group;
+    };
+    // An instruction of a compiled template: a literal run of the step's
+    // text, a part of the name, or a number or date field padded with
+    // zeros to width.
+    enum Token {Literal, BaseName, Suffix, Parent, Counter, Size, Date};
+    struct Instruction
+    {
+        Token token;
+        MetadataCache::Field field;
+        char16_t date;
+        qsizetype offset;
+        qsizetype length;
+        int width;
+    };
+    // One compiled rule of the chain.
+    struct Step
+    {
+        Task::Mask mask;
+        Task::Rule rule;
+        Kernel kernel;
+        QString text;
+        QString replacement;
+        Qt::CaseSensitivity caseSensitivity;
+        QStringMatcher matcher;
+        QRegularExpression regex;
+        QList<Piece> pieces;
+        QList<Instruction> program;
+        // The task and the metadata a template reads, set by bind().
+        const Task* task;
+        QList<qint64> metadata[MetadataCache::FieldCount];
+        bool plainPrefix;
+        Order order;
+        // Position of every item in that order, set by bind().
+        QList<qsizetype> ranks;
+        int ordinal;
+        int digits;
+        int modulus;
+        int offset;
+        int count;
+        CodePage codePage;
+        QString::NormalizationForm form;
+        UnicodeForm::Case letterCase;
+        Step();
+        void apply(QString&, qsizetype) const;
+    };
+    static constexpr qsizetype minMatcherPattern = 4;
+    QList<Step> steps;
+    QString error;
+    static void appendNumber(QString&, qint64, int);
+    static void changeCase(const Step&, QString&, qsizetype);
+    void compile(Step&, const QList<QString>&, const QList<int>&);
+    bool compileOrder(Step&, const QList<int>&);
+    static void compileReplacement(Step&);
+    void compileTemplate(Step&, const QString&);
+    static void formatOrdinal(const Step&, QString&, int);
+    static void deleteFirst(const Step&, QString&, qsizetype);
+    static void deleteLast(const Step&, QString&, qsizetype);
+    static void insertFirst(const Step&, QString&, qsizetype);
+    static void insertLast(const Step&, QString&, qsizetype);
+    static QString naturalKey(QStringView);
+    static void normalize(const Step&, QString&, qsizetype);
+    static void ordinalWithPrefix(const Step&, QString&, qsizetype);
+    static void ordinalWithPrefixReverse(const Step&, QString&, qsizetype);
+    static qsizetype position(const Step&, qsizetype);
+    static QList<qsizetype> rank(const Task&, Order);
+    static void rename(const Step&, QString&, qsizetype);
+    static void renderTemplate(const Step&, QString&, qsizetype);
+    static void replace(const Step&, QString&, qsizetype);
+    static void replaceMatcher(const Step&, QString&, qsizetype);
+    static void replaceRegex(const Step&, QString&, qsizetype);
+    static void toLocale(const Step&, QString&, qsizetype);
+    static void toUnicode(const Step&, QString&, qsizetype);
+};
+
+#endif // RENAMEPLAN_H
@@ -0,0 +1,212 @@
+#include "renamering.h"
+
+#if defined(Q_OS_LINUX) && __has_include(<linux/io_uring.h>)
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+// IORING_OP_RENAMEAT came with Linux 5.11, as did IORING_FEAT_EXT_ARG;
+// the operation itself is an enumerator and cannot be tested for.
+#if defined(IORING_FEAT_EXT_ARG) && defined(SYS_io_uring_setup)
+#define RENAMERING_SUPPORTED
+#endif
+#endif
+
+RenameRing::RenameRing(unsigned entries)
+    : fd(-1)
+    , entries(0)
+    , queued(0)
+    , pending(0)
+    , sqRing(nullptr)
+    , cqRing(nullptr)
+    , sqes(nullptr)
+    , sqRingSize(0)
+    , cqRingSize(0)
+    , sqesSize(0)
+    , sqHead(nullptr)
+    , sqTail(nullptr)
+    , sqMask(nullptr)
+    , sqArray(nullptr)
+    , cqHead(nullptr)
+    , cqTail(nullptr)
+    , cqMask(nullptr)
+    , cqes(nullptr)
+{
+#ifdef RENAMERING_SUPPORTED
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    this->fd = int(syscall(SYS_io_uring_setup, entries, &params));
+    if (this->fd < 0)
+        return;
+    this->entries = params.sq_entries;
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap)
+        this->sqRingSize = this->cqRingSize = qMax(this->sqRingSize, this->cqRingSize);
+    void* map = mmap(nullptr, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING);
+    this->sqRing = map == MAP_FAILED ? nullptr : map;
+    if (singleMap)
+    {
+        this->cqRing = this->sqRing;
+    }
+    else
+    {
+        map = mmap(nullptr, this->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_CQ_RING);
+        this->cqRing = map == MAP_FAILED ? nullptr : map;
+    }
+    this->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    map = mmap(nullptr, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES);
+    this->sqes = map == MAP_FAILED ? nullptr : map;
+    if (!this->sqRing || !this->cqRing || !this->sqes || !this->probe())
+    {
+        this->unmap();
+        return;
+    }
+    char* sq = static_cast<char*>(this->sqRing);
+    this->sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    this->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    this->sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    this->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(this->cqRing);
+    this->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    this->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    this->cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    this->cqes = cq + params.cq_off.cqes;
+#else
+    Q_UNUSED(entries);
+#endif
+}
+
+RenameRing::~RenameRing()
+{
+    // The kernel may still read the paths of renames in flight.
+    QList<Completion> completions;
+    if (this->pending)
+        this->reap(completions, unsigned(this->pending));
+    this->unmap();
+}
+
+qsizetype RenameRing::inFlight() const
+{
+    return this->pending;
+}
+
+bool RenameRing::isFull() const
+{
+    // Keeping no more renames than submission entries in flight also
+    // keeps the completion queue, twice as large, from overflowing.
+    return this->pending >= qsizetype(this->entries);
+}
+
+bool RenameRing::isValid() const
+{
+    return this->fd >= 0;
+}
+
+bool RenameRing::push(int dirfd, const char* from, const char* to, unsigned flags, quint64 tag)
+{
+#ifdef RENAMERING_SUPPORTED
+    if (!this->isValid() || this->isFull())
+        return false;
+    // Only this thread writes the tail; the kernel only reads it.
+    unsigned tail = *this->sqTail;
+    unsigned index = tail & *this->sqMask;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(this->sqes) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_RENAMEAT;
+    sqe->fd = dirfd;
+    sqe->addr = quint64(reinterpret_cast<quintptr>(from));
+    sqe->len = unsigned(dirfd);
+    sqe->addr2 = quint64(reinterpret_cast<quintptr>(to));
+    sqe->rename_flags = flags;
+    sqe->user_data = tag;
+    this->sqArray[index] = index;
+    __atomic_store_n(this->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++this->queued;
+    ++this->pending;
+    return true;
+#else
+    Q_UNUSED(dirfd);
+    Q_UNUSED(from);
+    Q_UNUSED(to);
+    Q_UNUSED(flags);
+    Q_UNUSED(tag);
+    return false;
+#endif
+}
+
+bool RenameRing::reap(QList<Completion>& completions, unsigned minimum)
+{
+#ifdef RENAMERING_SUPPORTED
+    // Submits everything queued and returns once at least minimum renames
+    // (or all those in flight) have completed, with whatever else has.
+    qsizetype wanted = qMin(qsizetype(minimum), this->pending);
+    qsizetype reaped = 0;
+    forever
+    {
+        unsigned head = *this->cqHead;
+        unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const struct io_uring_cqe* cqe = static_cast<const struct io_uring_cqe*>(this->cqes) + (head & *this->cqMask);
+            completions.append(Completion{cqe->user_data, cqe->res});
+            ++reaped;
+            --this->pending;
+        }
+        __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+        if (!this->queued && reaped >= wanted)
+            return true;
+        unsigned waitFor = reaped < wanted ? unsigned(wanted - reaped) : 0;
+        long submitted = syscall(SYS_io_uring_enter, this->fd, this->queued, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (submitted < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            return false;
+        }
+        this->queued -= unsigned(submitted);
+    }
+#else
+    Q_UNUSED(completions);
+    Q_UNUSED(minimum);
+    return false;
+#endif
+}
+
+bool RenameRing::probe()
+{
+#ifdef RENAMERING_SUPPORTED
+    // A kernel with io_uring but older than 5.11 rejects the operation
+    // only when it runs, so ask up front.
+    constexpr unsigned probeOps = 256;
+    alignas(struct io_uring_probe) char buffer[sizeof(struct io_uring_probe) + probeOps * sizeof(struct io_uring_probe_op)];
+    memset(buffer, 0, sizeof(buffer));
+    struct io_uring_probe* probe = reinterpret_cast<struct io_uring_probe*>(buffer);
+    if (syscall(SYS_io_uring_register, this->fd, IORING_REGISTER_PROBE, probe, probeOps) < 0)
+        return false;
+    return probe->last_op >= IORING_OP_RENAMEAT && (probe->ops[IORING_OP_RENAMEAT].flags & IO_URING_OP_SUPPORTED);
+#else
+    return false;
+#endif
+}
+
+void RenameRing::unmap()
+{
+#ifdef RENAMERING_SUPPORTED
+    if (this->sqes)
+        munmap(this->sqes, this->sqesSize);
+    if (this->cqRing && this->cqRing != this->sqRing)
+        munmap(this->cqRing, this->cqRingSize);
+    if (this->sqRing)
+        munmap(this->sqRing, this->sqRingSize);
+    if (this->fd >= 0)
+        close(this->fd);
+#endif
+    this->sqes = this->cqRing = this->sqRing = nullptr;
+    this->fd = -1;
+    this->pending = 0;
+    this->queued = 0;
+}
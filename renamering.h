@@ -0,0 +1,54 @@
+#ifndef RENAMERING_H
+#define RENAMERING_H
+
+#include <QList>
+
+// A Linux io_uring (5.11 or later) used only for IORING_OP_RENAMEAT,
+// driven through the raw syscalls. Renames are queued with push() and
+// submitted in one io_uring_enter() by reap(), which also collects what
+// has completed; the kernel runs them concurrently, which hides the
+// latency of network and FUSE filesystems. Paths are only borrowed: they
+// must stay alive until the completion carrying their tag is reaped.
+// isValid() is false wherever the kernel or the headers the build used
+// lack io_uring or its rename operation.
+class RenameRing
+{
+public:
+    struct Completion
+    {
+        quint64 tag;
+        int result;
+    };
+    explicit RenameRing(unsigned);
+    ~RenameRing();
+    qsizetype inFlight() const;
+    bool isFull() const;
+    bool isValid() const;
+    bool push(int, const char*, const char*, unsigned, quint64);
+    bool reap(QList<Completion>&, unsigned);
+
+private:
+    Q_DISABLE_COPY(RenameRing)
+    int fd;
+    unsigned entries;
+    unsigned queued;
+    qsizetype pending;
+    void* sqRing;
+    void* cqRing;
+    void* sqes;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    void* cqes;
+    bool probe();
+    void unmap();
+};
+
+#endif // RENAMERING_H
@@ -0,0 +1,184 @@
+#include <QCoreApplication>
+#include <algorithm>
+#include <numeric>
+#include "renamescheduler.h"
+
+RenameScheduler::RenameScheduler(const HistoryStore& store)
+    : renames(0)
+{
+    QList<Operation> nodes;
+    QList<int> levels;
+    QList<int> dirLevels(store.dirCount(), -1);
+    for (qsizetype item = 0; item < store.size(); ++item)
+    {
+        qsizetype depth = store.depth(item);
+        if (depth > 1)
+        {
+            Operation node;
+            node.kind = RenameScheduler::Direct;
+            node.item = item;
+            node.dir = store.dirId(item);
+            node.from = store.fileName(item, 0);
+            node.to = store.fileName(item, depth - 1);
+            if (dirLevels.at(node.dir) < 0)
+                dirLevels[node.dir] = int(store.dirAt(node.dir).count(QChar('/')));
+            levels.append(dirLevels.at(node.dir));
+            nodes.append(node);
+        }
+    }
+    // A task may hold a directory together with entries below it. Deeper
+    // directories are done first, so that no entry is renamed after one of
+    // its parents has moved it away from the path the task knows.
+    QList<qsizetype> byLevel(nodes.size());
+    std::iota(byLevel.begin(), byLevel.end(), 0);
+    std::stable_sort(byLevel.begin(), byLevel.end(), [&](qsizetype a, qsizetype b) {
+        return levels.at(a) > levels.at(b);
+    });
+    QList<Operation> sorted;
+    QList<int> sortedLevels;
+    sorted.reserve(nodes.size());
+    sortedLevels.reserve(nodes.size());
+    foreach (qsizetype i, byLevel)
+    {
+        sorted.append(nodes.at(i));
+        sortedLevels.append(levels.at(i));
+    }
+    nodes.swap(sorted);
+    levels.swap(sortedLevels);
+    QHash<QPair<quint32, QString>, qsizetype> sources;
+    for (qsizetype i = 0; i < nodes.size(); ++i)
+    {
+        QPair<quint32, QString> source = qMakePair(nodes.at(i).dir, nodes.at(i).from);
+        if (!sources.contains(source))
+            sources.insert(source, i);
+    }
+    // Every node depends on at most one other node, the one currently
+    // holding its target name, so the graph is a set of chains that either
+    // end in a free name or run into a cycle.
+    qsizetype size = nodes.size();
+    QList<qsizetype> dependency(size, -1);
+    QList<qsizetype> firstDependent(size, -1);
+    QList<qsizetype> nextDependent(size, -1);
+    for (qsizetype i = 0; i < size; ++i)
+    {
+        qsizetype d = sources.value(qMakePair(nodes.at(i).dir, nodes.at(i).to), -1);
+        if (d == i)
+        {
+            nodes[i].kind = RenameScheduler::Unchanged;
+        }
+        else if (d >= 0)
+        {
+            dependency[i] = d;
+            nextDependent[i] = firstDependent.at(d);
+            firstDependent[d] = i;
+        }
+    }
+    enum State {Waiting, Parked, Scheduled};
+    QList<State> state(size, Waiting);
+    QList<qsizetype> ready;
+    this->operations.reserve(size);
+    auto release = [&](qsizetype node) {
+        for (qsizetype k = firstDependent.at(node); k >= 0; k = nextDependent.at(k))
+            ready.append(k);
+    };
+    auto drain = [&]() {
+        while (!ready.isEmpty())
+        {
+            qsizetype i = ready.takeLast();
+            if (state.at(i) == Parked)
+            {
+                // The dependents of a parked node were released when it was
+                // parked; only its own final rename is left.
+                nodes[i].kind = RenameScheduler::FromTemporary;
+                this->operations.append(nodes.at(i));
+                state[i] = Scheduled;
+            }
+            else
+            {
+                this->operations.append(nodes.at(i));
+                state[i] = Scheduled;
+                release(i);
+            }
+        }
+    };
+    QList<qsizetype> walk(size, -1);
+    // Dependencies never leave a directory, so every level is scheduled
+    // completely before the next one up.
+    for (qsizetype begin = 0, end = 0; begin < size; begin = end)
+    {
+        while (end < size && levels.at(end) == levels.at(begin))
+            ++end;
+        for (qsizetype i = begin; i < end; ++i)
+            if (dependency.at(i) < 0)
+                ready.append(i);
+        drain();
+        for (qsizetype i = begin; i < end; ++i)
+        {
+            if (state.at(i) != Waiting)
+                continue;
+            // Whatever is still waiting lies on a cycle or on a chain
+            // leading into one. Follow the dependencies until a node
+            // repeats; that node is on the cycle and gets parked to break
+            // it.
+            qsizetype j = i;
+            while (state.at(j) == Waiting && walk.at(j) != i)
+            {
+                walk[j] = i;
+                j = dependency.at(j);
+            }
+            if (state.at(j) != Waiting)
+                continue;
+            Operation park = nodes.at(j);
+            park.kind = RenameScheduler::ToTemporary;
+            this->operations.append(park);
+            state[j] = Parked;
+            release(j);
+            drain();
+        }
+    }
+    foreach (const auto& operation, this->operations)
+        if (operation.kind == RenameScheduler::Direct || operation.kind == RenameScheduler::FromTemporary)
+            ++this->renames;
+    // The operations of a level are contiguous; within it, every
+    // directory gets one shard, keeping the order of its operations.
+    QHash<quint32, qsizetype> shardOf;
+    int level = -1;
+    for (qsizetype i = 0; i < this->operations.size(); ++i)
+    {
+        quint32 dir = this->operations.at(i).dir;
+        if (dirLevels.at(dir) != level)
+        {
+            level = dirLevels.at(dir);
+            shardOf.clear();
+        }
+        QHash<quint32, qsizetype>::const_iterator found = shardOf.constFind(dir);
+        if (found == shardOf.cend())
+        {
+            Shard shard;
+            shard.level = level;
+            this->shards.append(shard);
+            found = shardOf.insert(dir, this->shards.size() - 1);
+        }
+        this->shards[found.value()].operations.append(i);
+    }
+}
+
+QString RenameScheduler::temporaryName(qsizetype item, int attempt)
+{
+    return QString(".koi-renamer-%1-%2-%3.tmp").arg(QCoreApplication::applicationPid()).arg(item).arg(attempt);
+}
+
+const QList<RenameScheduler::Operation>& RenameScheduler::getOperations() const
+{
+    return this->operations;
+}
+
+const QList<RenameScheduler::Shard>& RenameScheduler::getShards() const
+{
+    return this->shards;
+}
+
+qsizetype RenameScheduler::renameCount() const
+{
+    return this->renames;
+}
@@ -0,0 +1,46 @@
+#ifndef RENAMESCHEDULER_H
+#define RENAMESCHEDULER_H
+
+#include <historystore.h>
+
+// Orders the renames of a previewed HistoryStore so that every item can be
+// renamed in a single pass: an item whose target is still the current name
+// of another item waits for that item to move, and each cycle of such
+// dependencies (swaps, rotations) is broken by parking exactly one of its
+// members under a temporary name. Entries of deeper directories are
+// renamed before the directories above them.
+//
+// Dependencies never leave a directory, so the operations also come split
+// into shards, one per directory and level, in the order they are to run
+// in: shards of one level are independent of each other and may run
+// concurrently, while a level must wait for the deeper ones.
+class RenameScheduler
+{
+public:
+    enum Kind {Direct, ToTemporary, FromTemporary, Unchanged};
+    struct Operation
+    {
+        Kind kind;
+        qsizetype item;
+        quint32 dir;
+        QString from;
+        QString to;
+    };
+    struct Shard
+    {
+        int level;
+        QList<qsizetype> operations;
+    };
+    RenameScheduler(const HistoryStore&);
+    static QString temporaryName(qsizetype, int);
+    const QList<Operation>& getOperations() const;
+    const QList<Shard>& getShards() const;
+    qsizetype renameCount() const;
+
+private:
+    QList<Operation> operations;
+    QList<Shard> shards;
+    qsizetype renames;
+};
+
+#endif // RENAMESCHEDULER_H
@@ -0,0 +1,121 @@
+#include <QSet>
+#include <QtTest>
+#include "historystore.h"
+#include "renamescheduler.h"
+
+// Schedules renames and carries the operations out on a model of the
+// directory: no step may miss its source or land on a name still taken,
+// every cycle is broken by parking exactly one of its members, and the
+// entries of a directory are renamed before the directory itself.
+
+static HistoryStore storeOf(const QStringList& renames)
+{
+    HistoryStore store;
+    foreach (const auto& rename, renames)
+    {
+        QStringList names = rename.split(QChar('>'));
+        store.append(QStringLiteral("/t/") + names.at(0));
+        store.push(store.size() - 1, names.at(1));
+    }
+    return store;
+}
+
+class RenameSchedulerTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void deeperLevelsFirst();
+    void runsWithoutOverwriting_data();
+    void runsWithoutOverwriting();
+};
+
+void RenameSchedulerTest::deeperLevelsFirst()
+{
+    HistoryStore store;
+    store.append(u"/r/d");
+    store.push(0, u"e");
+    store.append(u"/r/d/f");
+    store.push(1, u"g");
+    store.append(u"/r/x");
+    store.push(2, u"y");
+    store.append(u"/r/d/h");
+    store.push(3, u"i");
+    RenameScheduler scheduler(store);
+    const QList<RenameScheduler::Operation>& operations = scheduler.getOperations();
+    QCOMPARE(operations.size(), qsizetype(4));
+    QCOMPARE(scheduler.renameCount(), qsizetype(4));
+    QCOMPARE(store.dirAt(operations.at(0).dir), QStringLiteral("/r/d/"));
+    QCOMPARE(store.dirAt(operations.at(1).dir), QStringLiteral("/r/d/"));
+    QCOMPARE(store.dirAt(operations.at(2).dir), QStringLiteral("/r/"));
+    QCOMPARE(store.dirAt(operations.at(3).dir), QStringLiteral("/r/"));
+    // One shard per directory and level, the deeper one first.
+    const QList<RenameScheduler::Shard>& shards = scheduler.getShards();
+    QCOMPARE(shards.size(), qsizetype(2));
+    QVERIFY(shards.at(0).level > shards.at(1).level);
+    QCOMPARE(shards.at(0).operations, QList<qsizetype>({0, 1}));
+    QCOMPARE(shards.at(1).operations, QList<qsizetype>({2, 3}));
+}
+
+void RenameSchedulerTest::runsWithoutOverwriting_data()
+{
+    QTest::addColumn<QStringList>("renames");
+    QTest::addColumn<int>("parks");
+    QTest::newRow("chain") << QStringList{"a>b", "b>c", "c>d"} << 0;
+    QTest::newRow("chainBackwards") << QStringList{"c>d", "b>c", "a>b"} << 0;
+    QTest::newRow("swap") << QStringList{"a>b", "b>a"} << 1;
+    QTest::newRow("rotation") << QStringList{"a>b", "b>c", "c>d", "d>e", "e>a"} << 1;
+    QTest::newRow("twoSwaps") << QStringList{"a>b", "c>d", "b>a", "d>c"} << 2;
+    QTest::newRow("unchanged") << QStringList{"a>a", "b>c"} << 0;
+    QTest::newRow("mixed") << QStringList{"x>y", "a>b", "w>x", "b>c", "c>a", "v>w", "k>k"} << 1;
+}
+
+void RenameSchedulerTest::runsWithoutOverwriting()
+{
+    QFETCH(QStringList, renames);
+    QFETCH(int, parks);
+    HistoryStore store = storeOf(renames);
+    RenameScheduler scheduler(store);
+    QSet<QString> present;
+    QSet<QString> expected;
+    qsizetype renameCount = 0;
+    for (qsizetype i = 0; i < store.size(); ++i)
+    {
+        present.insert(store.fileName(i, 0));
+        expected.insert(store.fileName(i, 1));
+        if (store.fileName(i, 0) != store.fileName(i, 1))
+            ++renameCount;
+    }
+    QCOMPARE(scheduler.renameCount(), renameCount);
+    int parked = 0;
+    foreach (const auto& operation, scheduler.getOperations())
+    {
+        QString from = operation.from;
+        QString to = operation.to;
+        switch (operation.kind)
+        {
+            case RenameScheduler::Unchanged:
+                QCOMPARE(from, to);
+            continue;
+            case RenameScheduler::ToTemporary:
+                to = RenameScheduler::temporaryName(operation.item, 0);
+                ++parked;
+            break;
+            case RenameScheduler::FromTemporary:
+                from = RenameScheduler::temporaryName(operation.item, 0);
+            break;
+            default:
+            break;
+        }
+        QVERIFY2(present.contains(from), qPrintable(from + " is missing"));
+        QVERIFY2(!present.contains(to), qPrintable(to + " is taken"));
+        present.remove(from);
+        present.insert(to);
+    }
+    QCOMPARE(parked, parks);
+    QCOMPARE(present, expected);
+}
+
+QTEST_GUILESS_MAIN(RenameSchedulerTest)
+
+#include "renameschedulertest.moc"
@@ -1,49 +1,93 @@
+#include <QAtomicInteger>
 #include <QDir>
-#include <QTextCodec>
+#include <QMutex>
+#include <QSet>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentMap>
+#include "codepointindex.h"
+#include "directorysnapshot.h"
+#include "metadatacache.h"
+#include "preflight.h"
+#include "renameexecutor.h"
+#include "renamejournal.h"
+#include "renameplan.h"
+#include "renamescheduler.h"
 #include "task.h"
+#include "trace.h"
+
+// What the shards of a run share; the journal and the progress callback
+// are only used under the mutex, by one shard at a time.
+struct Task::Execution
+{
+    Execution(const Progress& progress, RenameJournal* journal, qsizetype total)
+        : progress(progress)
+        , journal(journal)
+        , total(total)
+        , done(0)
+        , failed(0)
+        , canceled(0)
+    {
+    }
+    const Progress& progress;
+    RenameJournal* journal;
+    QMutex mutex;
+    qsizetype total;
+    qsizetype done;
+    qsizetype failed;
+    QAtomicInt canceled;
+};
+
+struct Task::PreviewChunk
+{
+    qsizetype begin;
+    qsizetype end;
+    HistoryStore::Batch batch;
+};
+
+// Changes to the store found by one shard, applied once all are done.
+struct Task::ShardResult
+{
+    QList<qsizetype> truncated;
+    QList<QPair<qsizetype, QString>> parked;
+};
+
+// Every task object gets a generation of its own, copies included, so
+// that a metadata cache knows which of the tasks sharing it owns it.
+static QAtomicInteger<quint64> generations;
 
 Task::Task()
+    : observer(nullptr)
+    , generation(++generations)
 {
     this->clear();
 }
 
+Task::Task(const Task& other)
+    : store(other.store)
+    , status(other.status)
+    , observer(nullptr)
+    , generation(++generations)
+    , metadataCache(other.metadataCache)
+{
+}
+
+Task& Task::operator=(const Task& other)
+{
+    // The observer watches this object, not the one assigned from. The
+    // items are replaced, so the metadata kept for the old ones goes too,
+    // and the cache shared instead is owned by the other task.
+    this->store = other.store;
+    this->status = other.status;
+    this->generation = ++generations;
+    this->metadataCache = other.metadataCache;
+    if (this->observer)
+        this->observer->itemsReset();
+    return *this;
+}
+
 qsizetype Task::indexofUtf8(QByteArray& stringUtf8, qsizetype base, qsizetype offsetUtf8)
 {
-    if (offsetUtf8 > 0)
-    {
-        ++offsetUtf8;
-        while (offsetUtf8)
-        {
-            if (base >= 0 && base < stringUtf8.size())
-            {
-                if ((stringUtf8.at(base) & char(0xc0)) ^ char(0x80))
-                    --offsetUtf8;
-            }
-            else
-            {
-                --offsetUtf8;
-            }
-            ++base;
-        }
-        --base;
-    }
-    else if (offsetUtf8 < 0)
-    {
-        while (offsetUtf8)
-        {
-            --base;
-            if (base >= 0 && base < stringUtf8.size())
-            {
-                if ((stringUtf8.at(base) & char(0xc0)) ^ char(0x80))
-                    ++offsetUtf8;
-            }
-            else
-            {
-                ++offsetUtf8;
-            }
-        }
-    }
-    return base;
+    return CodePointIndex::seekUtf8(stringUtf8.constData(), stringUtf8.size(), base, offsetUtf8);
 }
 
 bool Task::isAllInOneDir(const RenameHistory & history)
@@ -65,9 +109,8 @@ bool Task::isAllInOneDir(const RenameHistory & history)
 
 void Task::append(const QString& filename)
 {
-    RenameHistory history;
-    history.push(QString(filename));
-    this->filelist.append(history);
+    this->detachMetadata();
+    this->store.append(filename);
     switch (this->status)
     {
         case Task::Pending:
@@ -76,17 +119,85 @@ void Task::append(const QString& filename)
             this->setStatus(Task::Pending);
         break;
     }
+    if (this->observer)
+        this->observer->itemsAppended(this->store.size() - 1, this->store.size());
+}
+
+void Task::append(const QString& filename, const QString& newFileName)
+{
+    this->detachMetadata();
+    this->store.append(filename);
+    this->store.push(this->store.size() - 1, newFileName);
+    this->setStatus(Task::Tested);
+    if (this->observer)
+        this->observer->itemsAppended(this->store.size() - 1, this->store.size());
+}
+
+void Task::append(const QString& dirPrefix, const QStringList& fileNames)
+{
+    if (fileNames.isEmpty())
+        return;
+    this->detachMetadata();
+    qsizetype begin = this->store.size();
+    foreach (const auto& fileName, fileNames)
+        this->store.append(dirPrefix, fileName);
+    this->setStatus(Task::Pending);
+    if (this->observer)
+        this->observer->itemsAppended(begin, this->store.size());
+}
+
+Task::const_iterator Task::begin() const
+{
+    return const_iterator(this, 0);
+}
+
+Task::const_iterator Task::cbegin() const
+{
+    return const_iterator(this, 0);
+}
+
+Task::const_iterator Task::cend() const
+{
+    return const_iterator(this, this->store.size());
 }
 
 void Task::clear()
 {
-    this->filelist.clear();
+    this->store.clear();
+    this->metadataCache.reset(new MetadataCache(this->generation));
     this->setStatus(Task::Ready);
+    if (this->observer)
+        this->observer->itemsReset();
+}
+
+qsizetype Task::depth(qsizetype i) const
+{
+    return this->store.depth(i);
 }
 
-Task::Filelist Task::getFilelist() const
+QString Task::dirPath(qsizetype i) const
 {
-    return this->filelist;
+    return this->store.dirPath(i);
+}
+
+Task::const_iterator Task::end() const
+{
+    return const_iterator(this, this->store.size());
+}
+
+QString Task::fileName(qsizetype i, qsizetype step) const
+{
+    return this->store.fileName(i, step);
+}
+
+QStringView Task::fileNameView(qsizetype i, qsizetype step) const
+{
+    return this->store.fileNameView(i, step);
+}
+
+QString Task::filePath(qsizetype i, qsizetype step) const
+{
+    return this->store.filePath(i, step);
 }
 
 Task::Status Task::getStatus() const
@@ -94,307 +205,382 @@ Task::Status Task::getStatus() const
     return this->status;
 }
 
+Task::RenameHistory Task::history(qsizetype i) const
+{
+    RenameHistory history;
+    qsizetype depth = this->store.depth(i);
+    history.reserve(depth);
+    for (qsizetype step = 0; step < depth; ++step)
+        history.push(this->store.filePath(i, step));
+    return history;
+}
+
 bool Task::isEmpty() const
 {
-    return this->filelist.isEmpty();
+    return this->store.isEmpty();
 }
 
-void Task::renameAll(Mask mask, Rule rule, const QList<QString>& strings, const QList<int>& numbers)
+const MetadataCache& Task::metadata() const
 {
-    this->renameTestAll(mask, rule, strings, numbers);
-    int maxHistory = 2;
-    for (int i = 1; i < maxHistory; ++i)
+    return *this->metadataCache;
+}
+
+QList<qsizetype> Task::preflight(Resolution resolution)
+{
+    // The names of a test run are checked against the directories as they
+    // are now, not against a snapshot kept from some earlier preview.
+    QList<qsizetype> collisions;
+    if (this->status != Task::Tested)
+        return collisions;
+    qsizetype size = this->store.size();
+    QList<QString> names(size);
+    for (qsizetype i = 0; i < size; ++i)
     {
-        for (Filelist::iterator history = this->filelist.begin(); history < this->filelist.end(); ++history)
-        {
-            int size = history->size();
-            if (size > i)
-            {
-                QFile file(history->at(i - 1));
-                if (file.rename(history->at(i)))
-                {
-                    if (size > maxHistory)
-                        maxHistory = size;
-                }
-                else
-                {
-                    history->remove(i, size - i);
-                }
-            }
-        }
+        qsizetype depth = this->store.depth(i);
+        if (depth > 1)
+            names[i] = this->store.fileName(i, depth - 1);
     }
-    this->setStatus(Task::Finished);
+    DirectorySnapshot snapshot;
+    collisions = Preflight::check(*this, names, resolution, snapshot);
+    if (resolution != Task::SuffixCollisions || collisions.isEmpty())
+        return collisions;
+    foreach (qsizetype item, collisions)
+    {
+        this->store.truncate(item, this->store.depth(item) - 1);
+        this->store.push(item, names.at(item));
+    }
+    if (this->observer)
+        this->observer->itemsChanged(collisions.first(), collisions.last() + 1);
+    return collisions;
+}
+
+Task::Range Task::range(qsizetype begin, qsizetype end) const
+{
+    qsizetype size = this->store.size();
+    return Range(this, qBound(qsizetype(0), begin, size), qBound(qsizetype(0), end, size));
+}
+
+bool Task::renameAll(Mask mask, Rule rule, const QList<QString>& strings, const QList<int>& numbers)
+{
+    return this->renameAll(RenamePlan(mask, rule, strings, numbers));
+}
+
+bool Task::renameAll(const RenamePlan& plan, const Progress& progress, RenameJournal* journal)
+{
+    if (!this->renameTestAll(plan))
+        return false;
+    return this->executeAll(progress, journal);
 }
 
-void Task::renameTestAll(Mask mask, Rule rule, const QList<QString>& strings, const QList<int>& numbers)
+bool Task::executeAll(const Progress& progress, RenameJournal* journal)
 {
-    Filelist::iterator history = this->filelist.begin();
-    switch (rule)
+    if (this->status != Task::Tested)
+        return false;
+    Trace::Span span("executeAll");
+    RenameScheduler scheduler(this->store);
+    if (journal)
     {
-        case Task::Rename:
-        case Task::Replace:
-        case Task::Insert:
-        case Task::InsertLast:
-        case Task::Delete:
-        case Task::DeleteLast:
-        case Task::ToUnicode:
-        case Task::ToLocale:
-            this->resetHistoryAll();
-            while (history < this->filelist.end())
+        // A parked item is planned in two steps through its temporary name,
+        // so that recovery knows where to look for it.
+        foreach (const auto& operation, scheduler.getOperations())
+        {
+            const QString& dir = this->store.dirAt(operation.dir);
+            if (operation.kind == RenameScheduler::Direct)
             {
-                this->renameTest(mask, rule, strings, numbers, history);
-                ++history;
+                journal->plan(dir + operation.from, dir + operation.to);
             }
-        break;
-        case Task::OrdinalWithPrefix:
-        {
-            this->resetHistoryAll();
-            int i = 0;
-            while (history < this->filelist.end())
+            else if (operation.kind == RenameScheduler::ToTemporary)
             {
-                QList<int> newNumbers = numbers;
-                newNumbers.append(i++);
-                this->renameTest(mask, rule, strings, newNumbers, history);
-                ++history;
+                QString temporary = RenameScheduler::temporaryName(operation.item, 0);
+                journal->planTemporary(dir + operation.from, dir + temporary);
+                journal->plan(dir + temporary, dir + operation.to);
             }
         }
-        break;
-        case Task::OrdinalWithPrefixReverse:
+        journal->sync();
+    }
+    Execution execution(progress, journal, scheduler.renameCount());
+    // The directories of a level are independent of each other, so their
+    // shards run on the global thread pool, each in the order the
+    // scheduler gave it; a level only starts once the deeper one is done.
+    // The store is only read meanwhile, and each shard's changes are
+    // applied to it afterwards.
+    const QList<RenameScheduler::Shard>& shards = scheduler.getShards();
+    QList<ShardResult> results(shards.size());
+    ShardResult* result = results.data();
+    for (qsizetype begin = 0, end = 0; begin < shards.size(); begin = end)
+    {
+        QList<qsizetype> level;
+        while (end < shards.size() && shards.at(end).level == shards.at(begin).level)
+            level.append(end++);
+        if (level.size() > 1)
         {
-            this->resetHistoryAll();
-            int i = 0;
-            while (history < this->filelist.end())
-            {
-                QList<int> newNumbers = numbers;
-                newNumbers.append(i--);
-                this->renameTest(mask, rule, strings, newNumbers, history);
-                ++history;
-            }
+            QtConcurrent::blockingMap(level, [&](qsizetype shard) {
+                this->executeShard(scheduler, shards.at(shard).operations, execution, result[shard]);
+            });
+        }
+        else
+        {
+            this->executeShard(scheduler, shards.at(begin).operations, execution, result[begin]);
         }
-        break;
-        default:
-            qWarning() << "No rename rule specified: " << rule;
-        return;
     }
-    if (this->filelist.isEmpty())
-        this->setStatus(Task::Ready);
-    else
-        this->setStatus(Task::Tested);
-}
-
-qsizetype Task::size() const
-{
-    return this->filelist.size();
+    foreach (const auto& shardResult, results)
+    {
+        foreach (qsizetype item, shardResult.truncated)
+            this->store.truncate(item, 1);
+        foreach (const auto& parked, shardResult.parked)
+            this->store.push(parked.first, parked.second);
+    }
+    if (journal)
+        journal->close();
+    Trace::add(Trace::Failures, execution.failed);
+    this->setStatus(Task::Finished);
+    if (this->observer)
+        this->observer->itemsChanged(0, this->store.size());
+    return true;
 }
 
-void Task::renameTest(Mask mask, Rule rule, const QList<QString>& strings, const QList<int>& numbers, Filelist::iterator& history)
+void Task::executeShard(const RenameScheduler& scheduler, const QList<qsizetype>& shard, Execution& execution, ShardResult& result) const
 {
-    if (!history->isEmpty())
+    const QList<RenameScheduler::Operation>& operations = scheduler.getOperations();
+    RenameExecutor executor(this->store, shard.size() >= Task::minBatchedShard);
+    QHash<qsizetype, QString> temporaries;
+    // Every rename that succeeds is journaled before anything else happens,
+    // so the journal never misses a completed step. While an item is parked
+    // each step is synced on its own, as recovery cannot tell the steps of
+    // a cycle apart from the files alone.
+    auto record = [&](quint32 dir, const QString& from, const QString& to) {
+        if (!execution.journal)
+            return;
+        QMutexLocker locker(&execution.mutex);
+        execution.journal->record(this->store.dirAt(dir) + from, this->store.dirAt(dir) + to);
+        if (!temporaries.isEmpty())
+            execution.journal->sync();
+    };
+    auto sync = [&]() {
+        if (!execution.journal)
+            return;
+        QMutexLocker locker(&execution.mutex);
+        execution.journal->sync();
+    };
+    auto move = [&](quint32 dir, const QString& from, const QString& to) {
+        if (!executor.rename(dir, from, to))
+            return false;
+        record(dir, from, to);
+        return true;
+    };
+    auto count = [&](bool succeeded) {
+        QMutexLocker locker(&execution.mutex);
+        if (succeeded)
+            ++execution.done;
+        else
+            ++execution.failed;
+        if (execution.progress && !execution.progress(execution.done, execution.failed, execution.total))
+            execution.canceled.storeRelaxed(1);
+    };
+    // Direct renames are submitted in batches when the executor has an
+    // io_uring. One that involves a name still in flight, and every step
+    // of a cycle, first waits for the batch, so that the order the
+    // scheduler chose still holds; completions find their item by tag.
+    QSet<QString> inFlight;
+    auto settle = [&](bool wait) {
+        foreach (const auto& completion, executor.takeCompleted(wait))
+        {
+            const RenameScheduler::Operation& operation = operations.at(completion.tag);
+            inFlight.remove(operation.from);
+            inFlight.remove(operation.to);
+            if (completion.succeeded)
+                record(operation.dir, operation.from, operation.to);
+            else
+                result.truncated.append(operation.item);
+            count(completion.succeeded);
+        }
+    };
+    foreach (qsizetype i, shard)
     {
-        QFileInfo file(history->top());
-        QString modText;
-        switch (mask)
+        const RenameScheduler::Operation& operation = operations.at(i);
+        // A cancel only takes effect while no item is parked under a
+        // temporary name; the steps not carried out are dropped so that the
+        // histories describe what is really on disk.
+        if (execution.canceled.loadRelaxed() && temporaries.isEmpty())
         {
-            case Task::ExtExcluded:
-                modText = file.completeBaseName();
-            break;
-            case Task::ExtOnly:
-                modText = file.suffix();
-            break;
-            default:
-                qWarning() << "No such rename mask: " << mask;
-            return;
+            result.truncated.append(operation.item);
+            continue;
+        }
+        if (operation.kind == RenameScheduler::Direct && executor.isBatching())
+        {
+            if (inFlight.contains(operation.from) || inFlight.contains(operation.to))
+                settle(true);
+            inFlight.insert(operation.from);
+            inFlight.insert(operation.to);
+            executor.submit(operation.dir, operation.from, operation.to, i);
+            settle(false);
+            continue;
         }
-        switch (rule)
+        if (operation.kind != RenameScheduler::Unchanged && !inFlight.isEmpty())
+            settle(true);
+        switch (operation.kind)
         {
-            case Task::Rename:
-                if (strings.size() == 1)
+            case RenameScheduler::Direct:
+                if (move(operation.dir, operation.from, operation.to))
                 {
-                    modText = strings.at(0);
+                    count(true);
                 }
                 else
                 {
-                    qWarning() << "Insufficient arguments: Rename.";
-                    return;
+                    result.truncated.append(operation.item);
+                    count(false);
                 }
             break;
-            case Task::OrdinalWithPrefix:
-            case Task::OrdinalWithPrefixReverse:
-                if (strings.size() == 2 && numbers.size() == 1)
+            case RenameScheduler::ToTemporary:
+            {
+                // The journal is synced on both sides of a park, with every
+                // temporary name tried planned before it is used.
+                bool parked = false;
+                for (int attempt = 0; !parked && attempt < Task::maxTemporaryAttempts; ++attempt)
                 {
-                    bool ok;
-                    QString ordinal = strings.at(1).trimmed();
-                    int suffix = ordinal.toInt(&ok) + numbers.at(0);
-                    if (ordinal.size() >= QString::number(INT_MAX).size())
-                        ok = false;
-                    if (ok)
+                    QString temporary = RenameScheduler::temporaryName(operation.item, attempt);
+                    if (attempt > 0 && execution.journal)
                     {
-                        int base = 10;
-                        int max = qPow(base, ordinal.size());
-                        if (suffix < 0)
-                            suffix = (suffix % max + max) % max;
-                        modText = QString("%1%2").arg(strings.at(0)).arg(suffix, ordinal.size(), base, QChar('0'));
+                        QMutexLocker locker(&execution.mutex);
+                        const QString& dir = this->store.dirAt(operation.dir);
+                        execution.journal->planTemporary(dir + operation.from, dir + temporary);
+                        execution.journal->plan(dir + temporary, dir + operation.to);
                     }
-                    else
+                    sync();
+                    parked = move(operation.dir, operation.from, temporary);
+                    if (parked)
                     {
-                        qWarning() << "Insufficient arguments: " << ordinal;
-                        return;
+                        temporaries.insert(operation.item, temporary);
+                        sync();
                     }
                 }
-                else
-                {
-                    qWarning() << "Insufficient arguments: OrdinalWithPrefix.";
-                    return;
-                }
-            break;
-            case Task::Replace:
-                if (strings.size() == 2)
-                {
-                    if (strings.at(0).size())
-                        modText.replace(strings.at(0), strings.at(1));
-                }
-                else
-                {
-                    qWarning() << "Insufficient arguments: Replace.";
-                    return;
-                }
-            break;
-            case Task::Insert:
-                if (strings.size() == 1 && numbers.size() == 1)
-                {
-                    //modText.insert(numbers.at(0), strings.at(0));
-                    QByteArray modTextUtf8 = modText.toUtf8();
-                    modText = QString::fromUtf8(modTextUtf8.insert(this->indexofUtf8(modTextUtf8, 0, numbers.at(0)), strings.at(0).toUtf8()));
-                }
-                else
-                {
-                    qWarning() << "Insufficient arguments: Insert.";
-                    return;
-                }
-            break;
-            case Task::InsertLast:
-                if (strings.size() == 1 && numbers.size() == 1)
-                {
-                    //QChar space(' ');
-                    //modText.prepend(&space, numbers.at(0) - modText.size());
-                    //modText.insert(modText.size() - numbers.at(0), strings.at(0));
-                    QByteArray modTextUtf8 = modText.toUtf8();
-                    int posUtf8 = this->indexofUtf8(modTextUtf8, modTextUtf8.size(), 0 - numbers.at(0));
-                    if (posUtf8 < 0)
-                        modTextUtf8.prepend(0 - posUtf8, char(' ')).insert(0, strings.at(0).toUtf8());
-                    else
-                        modTextUtf8.insert(posUtf8, strings.at(0).toUtf8());
-                    modText = QString::fromUtf8(modTextUtf8);
-                }
-                else
-                {
-                    qWarning() << "Insufficient arguments: InsertLast.";
-                    return;
-                }
-            break;
-            case Task::Delete:
-                if (numbers.size() == 2)
-                {
-                    //modText.remove(numbers.at(0), numbers.at(1));
-                    QByteArray modTextUtf8 = modText.toUtf8();
-                    int posUtf8begin = this->indexofUtf8(modTextUtf8, 0, numbers.at(0));
-                    int posUtf8end = this->indexofUtf8(modTextUtf8, posUtf8begin, numbers.at(1));
-                    modText = QString::fromUtf8(modTextUtf8.remove(posUtf8begin, posUtf8end - posUtf8begin));
-                }
-                else
-                {
-                    qWarning() << "Insufficient arguments: Delete.";
-                    return;
-                }
-            break;
-            case Task::DeleteLast:
-                if (numbers.size() == 2)
-                {
-                    /*
-                    int pos = modText.size() - numbers.at(0) - numbers.at(1);
-                    if (pos < 0)
-                        modText.remove(0, numbers.at(1) + pos);
-                    else
-                        modText.remove(pos, numbers.at(1));
-                    */
-                    QByteArray modTextUtf8 = modText.toUtf8();
-                    int posUtf8end = this->indexofUtf8(modTextUtf8, modTextUtf8.size(), 0 - numbers.at(0));
-                    int posUtf8begin = this->indexofUtf8(modTextUtf8, posUtf8end, 0 - numbers.at(1));
-                    if (posUtf8begin < 0)
-                        posUtf8begin = 0;
-                    modText = QString::fromUtf8(modTextUtf8.remove(posUtf8begin, posUtf8end - posUtf8begin));
-                }
-                else
-                {
-                    qWarning() << "Insufficient arguments: DeleteLast.";
-                    return;
-                }
-            break;
-            case Task::ToUnicode:
-                if (strings.size() == 1)
+                if (!parked)
                 {
-                    QTextCodec *codec = QTextCodec::codecForLocale();
-                    QByteArray encodedString = codec->fromUnicode(modText);
-                    codec = QTextCodec::codecForName(strings.at(0).toLatin1());
-                    modText = codec->toUnicode(encodedString);
-                }
-                else
-                {
-                    qWarning() << "Insufficient arguments: ToUnicode.";
-                    return;
+                    result.truncated.append(operation.item);
+                    count(false);
                 }
+            }
             break;
-            case Task::ToLocale:
-                if (strings.size() == 1)
+            case RenameScheduler::FromTemporary:
+            {
+                if (!temporaries.contains(operation.item))
+                    break;
+                QString temporary = temporaries.take(operation.item);
+                if (move(operation.dir, temporary, operation.to))
                 {
-                    QTextCodec *codec = QTextCodec::codecForName(strings.at(0).toLatin1());
-                    QByteArray encodedString = codec->fromUnicode(modText);
-                    codec = QTextCodec::codecForLocale();
-                    modText = codec->toUnicode(encodedString);
+                    count(true);
                 }
                 else
                 {
-                    qWarning() << "Insufficient arguments: ToLocale.";
-                    return;
+                    result.truncated.append(operation.item);
+                    // Put the file back, or record where it was left.
+                    if (!move(operation.dir, temporary, operation.from))
+                        result.parked.append(qMakePair(operation.item, temporary));
+                    count(false);
                 }
+                sync();
+            }
             break;
-            default:
-                qWarning() << "No such rename rule: " << rule;
-            return;
-        }
-        QString modFileName;
-        switch (mask)
-        {
-            case Task::ExtExcluded:
-                modFileName += modText;
-                if (file.fileName().contains(QChar('.')) || !file.suffix().isEmpty())
-                    modFileName += "." + file.suffix();
-            break;
-            case Task::ExtOnly:
-                modFileName += file.completeBaseName();
-                if (file.fileName().contains(QChar('.')) || !modText.isEmpty())
-                    modFileName += "." + modText;
+            case RenameScheduler::Unchanged:
+                result.truncated.append(operation.item);
             break;
-            default:
-                qWarning() << "No such rename mask: " << mask;
-            return;
         }
-        file.setFile(file.dir(), modFileName);
-        history->push(file.filePath());
     }
+    settle(true);
+}
+
+bool Task::renameTestAll(Mask mask, Rule rule, const QList<QString>& strings, const QList<int>& numbers)
+{
+    return this->renameTestAll(RenamePlan(mask, rule, strings, numbers));
+}
+
+bool Task::renameTestAll(const RenamePlan& plan)
+{
+    if (!plan.isValid())
+    {
+        qWarning() << "Invalid rename plan: " << plan.errorString();
+        return false;
+    }
+    Trace::Span span("renameTestAll");
+    Trace::add(Trace::Files, this->store.size());
+    this->resetHistoryAll();
+    RenamePlan bound = plan;
+    bound.bind(*this);
+    // Every item only reads its own history, so the list is split into
+    // contiguous chunks that are previewed on the global thread pool. The
+    // new basenames are pushed into the store afterwards, in order.
+    qsizetype size = this->store.size();
+    qsizetype chunkSize = qMax(Task::minPreviewChunk, size / (qMax(QThreadPool::globalInstance()->maxThreadCount(), 1) * 4) + 1);
+    QList<PreviewChunk> chunks;
+    for (qsizetype begin = 0; begin < size; begin += chunkSize)
+    {
+        PreviewChunk chunk;
+        chunk.begin = begin;
+        chunk.end = qMin(begin + chunkSize, size);
+        chunks.append(chunk);
+    }
+    if (chunks.size() > 1)
+    {
+        QtConcurrent::blockingMap(chunks, [&](PreviewChunk& chunk) {
+            this->renameTestRange(bound, chunk);
+        });
+    }
+    else if (!chunks.isEmpty())
+    {
+        this->renameTestRange(bound, chunks.first());
+    }
+    foreach (const auto& chunk, chunks)
+        this->store.pushBatch(chunk.begin, chunk.batch);
+    if (this->store.isEmpty())
+        this->setStatus(Task::Ready);
+    else
+        this->setStatus(Task::Tested);
+    if (this->observer)
+        this->observer->itemsChanged(0, this->store.size());
+    return true;
+}
+
+void Task::setObserver(Observer* observer)
+{
+    this->observer = observer;
 }
 
-void Task::resetHistory(Filelist::iterator& history)
+qsizetype Task::size() const
+{
+    return this->store.size();
+}
+
+void Task::detachMetadata()
+{
+    // The cache is indexed by item and shared with the copies of the task,
+    // which only ever see a prefix of its items; a copy that goes on to
+    // append other items starts a cache of its own.
+    if (!this->metadataCache->isOwnedBy(this->generation))
+        this->metadataCache.reset(new MetadataCache(this->generation));
+}
+
+void Task::renameTestRange(const RenamePlan& plan, PreviewChunk& chunk) const
 {
-    if (history->size() > 1)
-        history->remove(1, history->size() - 1);
+    QString modFileName;
+    chunk.batch.lengths.reserve(chunk.end - chunk.begin);
+    for (qsizetype i = chunk.begin; i < chunk.end; ++i)
+    {
+        if (plan.apply(this->store.fileNameView(i, this->store.depth(i) - 1), i, modFileName))
+        {
+            chunk.batch.names += modFileName;
+            chunk.batch.lengths.append(modFileName.size());
+        }
+        else
+        {
+            chunk.batch.lengths.append(-1);
+        }
+    }
 }
 
 void Task::resetHistoryAll()
 {
-    for (Filelist::iterator history = this->filelist.begin(); history < this->filelist.end(); ++history)
-        this->resetHistory(history);
-    if (this->filelist.isEmpty())
+    this->store.resetAll();
+    if (this->store.isEmpty())
         this->setStatus(Task::Ready);
     else
         this->setStatus(Task::Pending);
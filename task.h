@@ -1,43 +1,163 @@
 #ifndef TASK_H
 #define TASK_H
 
+#include <QSharedPointer>
 #include <QStack>
+#include <functional>
+#include <iterator>
+#include <historystore.h>
+
+class MetadataCache;
+class RenameJournal;
+class RenamePlan;
+class RenameScheduler;
 
 class Task
 {
 public:
     enum Mask {ExtExcluded, ExtOnly};
-    enum Rule {Rename, OrdinalWithPrefix, OrdinalWithPrefixReverse, Replace, Insert, InsertLast, Delete, DeleteLast, ToUnicode, ToLocale};
+    enum Rule {Rename, OrdinalWithPrefix, OrdinalWithPrefixReverse, Replace, Insert, InsertLast, Delete, DeleteLast, ToUnicode, ToLocale, Template, Normalize, ChangeCase};
     enum Status {Ready, Pending, Tested, Finished};
+    enum Resolution {ReportCollisions, SuffixCollisions};
     typedef QStack<QString> RenameHistory;
-    typedef QList<RenameHistory> Filelist;
-    //typedef Filelist::const_iterator const_iterator;
-    //typedef Filelist::iterator iterator;
+    // Called after every rename with the steps done, failed and planned;
+    // returning false cancels the remaining ones.
+    typedef std::function<bool(qsizetype, qsizetype, qsizetype)> Progress;
+    class Entry;
+    class Range;
+    class const_iterator;
+    class Observer;
     Task();
+    Task(const Task&);
+    Task& operator=(const Task&);
     static qsizetype indexofUtf8(QByteArray&, qsizetype, qsizetype);
     static bool isAllInOneDir(const RenameHistory&);
     void append(const QString&);
-    //iterator begin();
-    //const_iterator begin() const;
-    //const_iterator cbegin() const;
-    //const_iterator cend() const;
+    void append(const QString&, const QString&);
+    void append(const QString&, const QStringList&);
+    const_iterator begin() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
     void clear();
-    //iterator end();
-    //const_iterator end() const;
-    Filelist getFilelist() const;
+    qsizetype depth(qsizetype) const;
+    QString dirPath(qsizetype) const;
+    const_iterator end() const;
+    bool executeAll(const Progress& = Progress(), RenameJournal* = nullptr);
+    QString fileName(qsizetype, qsizetype) const;
+    QStringView fileNameView(qsizetype, qsizetype) const;
+    QString filePath(qsizetype, qsizetype) const;
     Status getStatus() const;
+    RenameHistory history(qsizetype) const;
     bool isEmpty() const;
-    void renameAll(Mask, Rule, const QList<QString>&, const QList<int>&);
-    void renameTestAll(Mask, Rule, const QList<QString>&, const QList<int>&);
+    const MetadataCache& metadata() const;
+    QList<qsizetype> preflight(Resolution);
+    Range range(qsizetype, qsizetype) const;
+    bool renameAll(Mask, Rule, const QList<QString>&, const QList<int>&);
+    bool renameAll(const RenamePlan&, const Progress& = Progress(), RenameJournal* = nullptr);
+    bool renameTestAll(Mask, Rule, const QList<QString>&, const QList<int>&);
+    bool renameTestAll(const RenamePlan&);
+    void setObserver(Observer*);
     qsizetype size() const;
 
 private:
-    Filelist filelist;
+    friend class TaskFile;
+    struct Execution;
+    struct PreviewChunk;
+    struct ShardResult;
+    static constexpr int maxTemporaryAttempts = 8;
+    static constexpr qsizetype minBatchedShard = 64;
+    static constexpr qsizetype minPreviewChunk = 4096;
+    HistoryStore store;
     Status status;
-    void renameTest(Mask, Rule, const QList<QString>&, const QList<int>&, Filelist::iterator&);
-    void resetHistory(Filelist::iterator&);
+    Observer* observer;
+    quint64 generation;
+    QSharedPointer<MetadataCache> metadataCache;
+    void detachMetadata();
+    void executeShard(const RenameScheduler&, const QList<qsizetype>&, Execution&, ShardResult&) const;
+    void renameTestRange(const RenamePlan&, PreviewChunk&) const;
     void resetHistoryAll();
     void setStatus(Status);
 };
 
+// Told about every change of the task it watches, after the fact, with
+// the half-open range of items involved. A task only ever has one
+// observer, and copies of it start without any.
+class Task::Observer
+{
+public:
+    virtual ~Observer() = default;
+    virtual void itemsAppended(qsizetype, qsizetype) = 0;
+    virtual void itemsChanged(qsizetype, qsizetype) = 0;
+    virtual void itemsReset() = 0;
+};
+
+// One item read in place from the store; like the iterators and ranges,
+// it is valid until the task is modified.
+class Task::Entry
+{
+public:
+    Entry(const Task* task = nullptr, qsizetype i = 0) : task(task), i(i) {}
+    qsizetype depth() const { return this->task->store.depth(this->i); }
+    quint32 dirId() const { return this->task->store.dirId(this->i); }
+    QString dirPath() const { return this->task->store.dirPath(this->i); }
+    const QString& dirPrefix() const { return this->task->store.dirPrefix(this->i); }
+    QString fileName(qsizetype step) const { return this->task->store.fileName(this->i, step); }
+    QStringView fileNameView(qsizetype step) const { return this->task->store.fileNameView(this->i, step); }
+    QString filePath(qsizetype step) const { return this->task->store.filePath(this->i, step); }
+    qsizetype index() const { return this->i; }
+
+private:
+    friend class Task::const_iterator;
+    const Task* task;
+    qsizetype i;
+};
+
+class Task::const_iterator
+{
+public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef Entry value_type;
+    typedef qsizetype difference_type;
+    typedef const Entry* pointer;
+    typedef const Entry& reference;
+    const_iterator(const Task* task = nullptr, qsizetype i = 0) : entry(task, i) {}
+    reference operator*() const { return this->entry; }
+    pointer operator->() const { return &this->entry; }
+    Entry operator[](difference_type n) const { return Entry(this->entry.task, this->entry.i + n); }
+    const_iterator& operator++() { ++this->entry.i; return *this; }
+    const_iterator operator++(int) { const_iterator it = *this; ++this->entry.i; return it; }
+    const_iterator& operator--() { --this->entry.i; return *this; }
+    const_iterator operator--(int) { const_iterator it = *this; --this->entry.i; return it; }
+    const_iterator& operator+=(difference_type n) { this->entry.i += n; return *this; }
+    const_iterator& operator-=(difference_type n) { this->entry.i -= n; return *this; }
+    const_iterator operator+(difference_type n) const { return const_iterator(this->entry.task, this->entry.i + n); }
+    const_iterator operator-(difference_type n) const { return const_iterator(this->entry.task, this->entry.i - n); }
+    difference_type operator-(const const_iterator& other) const { return this->entry.i - other.entry.i; }
+    bool operator==(const const_iterator& other) const { return this->entry.i == other.entry.i; }
+    bool operator!=(const const_iterator& other) const { return this->entry.i != other.entry.i; }
+    bool operator<(const const_iterator& other) const { return this->entry.i < other.entry.i; }
+    bool operator<=(const const_iterator& other) const { return this->entry.i <= other.entry.i; }
+    bool operator>(const const_iterator& other) const { return this->entry.i > other.entry.i; }
+    bool operator>=(const const_iterator& other) const { return this->entry.i >= other.entry.i; }
+
+private:
+    Entry entry;
+};
+
+// A contiguous run of items, clamped to the task, read without copying.
+class Task::Range
+{
+public:
+    Range(const Task* task, qsizetype begin, qsizetype end) : first(task, begin), last(task, qMax(begin, end)) {}
+    const_iterator begin() const { return this->first; }
+    const_iterator end() const { return this->last; }
+    bool isEmpty() const { return this->first == this->last; }
+    qsizetype size() const { return this->last - this->first; }
+    Entry operator[](qsizetype n) const { return this->first[n]; }
+
+private:
+    const_iterator first;
+    const_iterator last;
+};
+
 #endif // TASK_H
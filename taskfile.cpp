@@ -0,0 +1,121 @@
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+#include <cstring>
+#include "taskfile.h"
+#include "trace.h"
+
+// A plan file starts with the magic, a 32-bit version and the 32-bit task
+// status, little-endian, followed by the history store.
+static constexpr qsizetype planHeaderSize = 16;
+
+TaskFile::TaskFile(const QString& fileName)
+    : fileName(fileName)
+    , kind(TaskFile::PathList)
+{
+}
+
+QString TaskFile::errorString() const
+{
+    return this->error;
+}
+
+TaskFile::Format TaskFile::format() const
+{
+    return this->kind;
+}
+
+bool TaskFile::read(Task& task)
+{
+    Trace::Span span("readTaskFile");
+    QFile file(this->fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        this->error = tr("無法開啟 %1：%2").arg(this->fileName, file.errorString());
+        return false;
+    }
+    // Whatever cannot be mapped (a pipe, an empty file) is read whole.
+    QByteArray contents;
+    const char* data = reinterpret_cast<const char*>(file.size() > 0 ? file.map(0, file.size()) : nullptr);
+    qsizetype size = file.size();
+    if (!data)
+    {
+        contents = file.readAll();
+        data = contents.constData();
+        size = contents.size();
+    }
+    this->kind = size >= planHeaderSize && memcmp(data, TaskFile::magic, sizeof(TaskFile::magic)) == 0 ? TaskFile::Plan : TaskFile::PathList;
+    if (this->kind == TaskFile::Plan)
+        return this->readPlan(task, data, size);
+    return this->readPathList(task, data, size);
+}
+
+bool TaskFile::write(const Task& task)
+{
+    Trace::Span span("writeTaskFile");
+    QSaveFile file(this->fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        this->error = tr("無法寫入 %1：%2").arg(this->fileName, file.errorString());
+        return false;
+    }
+    char header[planHeaderSize];
+    memcpy(header, TaskFile::magic, sizeof(TaskFile::magic));
+    qToLittleEndian(TaskFile::version, header + 8);
+    qToLittleEndian(quint32(task.getStatus()), header + 12);
+    if (file.write(header, planHeaderSize) != planHeaderSize || !task.store.save(file) || !file.commit())
+    {
+        this->error = tr("無法寫入 %1：%2").arg(this->fileName, file.errorString());
+        return false;
+    }
+    this->kind = TaskFile::Plan;
+    return true;
+}
+
+bool TaskFile::readPathList(Task& task, const char* data, qsizetype size)
+{
+    // Blocks end on a NUL, so no path is split between two of them; each
+    // block is decoded in one call and its paths are appended as views.
+    Task loaded;
+    const char* end = data + size;
+    while (data < end)
+    {
+        const char* blockEnd = data + qMin(TaskFile::decodeBlock, qsizetype(end - data));
+        const char* nul = blockEnd < end ? static_cast<const char*>(memchr(blockEnd, '\0', end - blockEnd)) : nullptr;
+        blockEnd = nul ? nul + 1 : end;
+        QString text = QFile::decodeName(QByteArray::fromRawData(data, blockEnd - data));
+        QStringView rest(text);
+        while (!rest.isEmpty())
+        {
+            qsizetype separator = rest.indexOf(QChar(0));
+            QStringView path = separator < 0 ? rest : rest.left(separator);
+            rest = separator < 0 ? QStringView() : rest.mid(separator + 1);
+            if (!path.isEmpty())
+                loaded.store.append(path);
+        }
+        data = blockEnd;
+    }
+    loaded.setStatus(loaded.store.isEmpty() ? Task::Ready : Task::Pending);
+    task = loaded;
+    return true;
+}
+
+bool TaskFile::readPlan(Task& task, const char* data, qsizetype size)
+{
+    quint32 fileVersion = qFromLittleEndian<quint32>(data + 8);
+    quint32 status = qFromLittleEndian<quint32>(data + 12);
+    if (fileVersion != TaskFile::version)
+    {
+        this->error = tr("%1 的改名計畫格式版本 %2 不受支援。").arg(this->fileName).arg(fileVersion);
+        return false;
+    }
+    Task loaded;
+    if (status > Task::Finished || !loaded.store.load(data + planHeaderSize, size - planHeaderSize))
+    {
+        this->error = tr("%1 不是有效的改名計畫，或已經損毀。").arg(this->fileName);
+        return false;
+    }
+    loaded.setStatus(Task::Status(status));
+    task = loaded;
+    return true;
+}
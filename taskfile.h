@@ -0,0 +1,36 @@
+#ifndef TASKFILE_H
+#define TASKFILE_H
+
+#include <QCoreApplication>
+#include <task.h>
+
+// A task on disk, read through a memory map. A plan file keeps the items
+// with their histories as the store holds them, so loading one is a few
+// bulk copies, and a previewed plan can be applied later, or on another
+// machine, without the rules that computed it. Any other file is read as
+// a NUL-delimited path list in the local 8-bit encoding, decoded straight
+// from the map in large blocks rather than path by path.
+class TaskFile
+{
+    Q_DECLARE_TR_FUNCTIONS(TaskFile)
+
+public:
+    enum Format {PathList, Plan};
+    TaskFile(const QString&);
+    QString errorString() const;
+    Format format() const;
+    bool read(Task&);
+    bool write(const Task&);
+
+private:
+    static constexpr char magic[8] = {'K', 'O', 'I', 'P', 'L', 'A', 'N', '\0'};
+    static constexpr quint32 version = 1;
+    static constexpr qsizetype decodeBlock = 1 << 20;
+    QString fileName;
+    QString error;
+    Format kind;
+    bool readPathList(Task&, const char*, qsizetype);
+    bool readPlan(Task&, const char*, qsizetype);
+};
+
+#endif // TASKFILE_H
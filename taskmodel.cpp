@@ -0,0 +1,236 @@
+#include <QBrush>
+#include <algorithm>
+#include "taskmodel.h"
+
+TaskModel::TaskModel(QObject *parent)
+    : QAbstractTableModel(parent)
+    , task(nullptr)
+    , rows(0)
+    , previewing(false)
+    , collisionCount(0)
+    , resolution(Task::ReportCollisions)
+{
+}
+
+TaskModel::~TaskModel()
+{
+    if (this->task)
+        this->task->setObserver(nullptr);
+}
+
+int TaskModel::columnCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : TaskModel::ColumnCount;
+}
+
+QVariant TaskModel::data(const QModelIndex& index, int role) const
+{
+    if (!this->task || !index.isValid() || index.row() >= this->rows)
+        return QVariant();
+    // Rows are formatted on demand, so only the rows the view paints are
+    // ever turned into text.
+    qsizetype row = index.row();
+    qsizetype depth = this->task->depth(row);
+    bool collides = index.column() == TaskModel::NewName && this->showsCollisions() && row < this->collisions.size() && this->collisions.testBit(row);
+    switch (role)
+    {
+        case Qt::DisplayRole:
+            switch (index.column())
+            {
+                case TaskModel::OldName:
+                return this->task->fileName(row, 0);
+                case TaskModel::NewName:
+                    if (this->previewing)
+                        return this->preview.at(row);
+                    if (depth > 1)
+                        return this->task->fileName(row, depth - 1);
+                return QVariant();
+                case TaskModel::Directory:
+                return this->task->dirPath(row);
+                default:
+                return QVariant();
+            }
+        case Qt::ForegroundRole:
+            if (collides)
+                return QBrush(this->resolution == Task::SuffixCollisions ? Qt::darkYellow : Qt::red);
+        return QVariant();
+        case Qt::ToolTipRole:
+        {
+            if (collides)
+                return this->resolution == Task::SuffixCollisions ? tr("原本的新檔名已被占用，改加上編號。") : tr("新檔名與目錄中的現有項目或其他項目的新檔名相同。");
+            QString text = this->task->filePath(row, 0);
+            for (qsizetype i = 1; i < depth; ++i)
+                text += "　→　" + this->task->filePath(row, i);
+            return text;
+        }
+        default:
+        return QVariant();
+    }
+}
+
+QVariant TaskModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (role != Qt::DisplayRole)
+        return QVariant();
+    if (orientation == Qt::Vertical)
+        return section + 1;
+    switch (section)
+    {
+        case TaskModel::OldName:
+        return tr("原檔名");
+        case TaskModel::NewName:
+            if (this->showsCollisions() && this->collisionCount)
+                return (this->previewing ? tr("預覽（%1 個撞名）") : tr("測試（%1 個撞名）")).arg(this->collisionCount);
+            if (this->previewing)
+                return tr("預覽");
+            if (this->task)
+            {
+                switch (this->task->getStatus())
+                {
+                    case Task::Tested:
+                    return tr("測試");
+                    case Task::Finished:
+                    return tr("改名");
+                    default:
+                    break;
+                }
+            }
+        return tr("新檔名");
+        case TaskModel::Directory:
+        return tr("在目錄");
+        default:
+        return QVariant();
+    }
+}
+
+void TaskModel::beginPreview()
+{
+    // Rows keep a null name until their part of the preview arrives.
+    this->preview = QList<QString>(this->rows);
+    this->previewing = true;
+    this->clearCollisions();
+    this->updateColumn(TaskModel::NewName);
+}
+
+void TaskModel::clearPreview()
+{
+    if (!this->previewing)
+        return;
+    this->preview.clear();
+    this->previewing = false;
+    this->clearCollisions();
+    this->updateColumn(TaskModel::NewName);
+}
+
+bool TaskModel::isPreviewing() const
+{
+    return this->previewing;
+}
+
+void TaskModel::itemsAppended(qsizetype begin, qsizetype end)
+{
+    // Rows streamed into the task are inserted, keeping the view where it
+    // is.
+    if (begin != this->rows || end <= begin)
+    {
+        this->itemsReset();
+        return;
+    }
+    this->beginInsertRows(QModelIndex(), int(begin), int(end - 1));
+    this->rows = end;
+    if (this->previewing)
+        this->preview.resize(end);
+    this->endInsertRows();
+}
+
+void TaskModel::itemsChanged(qsizetype begin, qsizetype end)
+{
+    this->updateRows(begin, end);
+    emit this->headerDataChanged(Qt::Horizontal, TaskModel::NewName, TaskModel::NewName);
+}
+
+void TaskModel::itemsReset()
+{
+    this->beginResetModel();
+    this->rows = this->task ? this->task->size() : 0;
+    this->preview.clear();
+    this->previewing = false;
+    this->clearCollisions();
+    this->endResetModel();
+}
+
+int TaskModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : int(this->rows);
+}
+
+void TaskModel::setTask(Task* task)
+{
+    // The same task needs no reset, as its rows arrive as they change;
+    // only the header follows the status.
+    if (this->task == task)
+    {
+        emit this->headerDataChanged(Qt::Horizontal, TaskModel::NewName, TaskModel::NewName);
+        return;
+    }
+    if (this->task)
+        this->task->setObserver(nullptr);
+    this->task = task;
+    if (this->task)
+        this->task->setObserver(this);
+    this->itemsReset();
+}
+
+void TaskModel::setCollisions(const QList<qsizetype>& collisions, Task::Resolution resolution)
+{
+    if (!this->showsCollisions())
+        return;
+    this->collisions = QBitArray(int(this->rows));
+    this->collisionCount = 0;
+    this->resolution = resolution;
+    foreach (qsizetype row, collisions)
+    {
+        if (row < this->rows)
+        {
+            this->collisions.setBit(int(row));
+            ++this->collisionCount;
+        }
+    }
+    this->updateColumn(TaskModel::NewName);
+}
+
+void TaskModel::setPreview(qsizetype begin, const QStringList& fileNames)
+{
+    qsizetype end = begin + fileNames.size();
+    if (!this->previewing || begin < 0 || end > this->rows)
+        return;
+    std::copy(fileNames.cbegin(), fileNames.cend(), this->preview.begin() + begin);
+    if (begin < end)
+        emit this->dataChanged(this->index(int(begin), TaskModel::NewName), this->index(int(end - 1), TaskModel::NewName));
+}
+
+bool TaskModel::showsCollisions() const
+{
+    // Collisions belong to the names of a preview or of a test run; once
+    // the task has been renamed for real they no longer apply.
+    return this->previewing || (this->task && this->task->getStatus() == Task::Tested);
+}
+
+void TaskModel::clearCollisions()
+{
+    this->collisions.clear();
+    this->collisionCount = 0;
+}
+
+void TaskModel::updateColumn(int column)
+{
+    if (this->rows)
+        emit this->dataChanged(this->index(0, column), this->index(int(this->rows - 1), column));
+    emit this->headerDataChanged(Qt::Horizontal, column, column);
+}
+
+void TaskModel::updateRows(qsizetype begin, qsizetype end)
+{
+    if (begin < end && end <= this->rows)
+        emit this->dataChanged(this->index(int(begin), 0), this->index(int(end - 1), TaskModel::ColumnCount - 1));
+}
@@ -0,0 +1,48 @@
+#ifndef TASKMODEL_H
+#define TASKMODEL_H
+
+#include <QAbstractTableModel>
+#include <QBitArray>
+#include <task.h>
+
+// Table of a task's items. The model observes the task it shows, so rows
+// streamed in or renamed reach the view without handing the task over
+// again. New names found colliding by a preflight, of a preview or of a
+// test run, are marked until the next preview.
+class TaskModel : public QAbstractTableModel, public Task::Observer
+{
+    Q_OBJECT
+
+public:
+    enum Column {OldName, NewName, Directory, ColumnCount};
+    TaskModel(QObject *parent = nullptr);
+    ~TaskModel();
+    void beginPreview();
+    void clearPreview();
+    int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex&, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int, Qt::Orientation, int role = Qt::DisplayRole) const override;
+    bool isPreviewing() const;
+    void itemsAppended(qsizetype, qsizetype) override;
+    void itemsChanged(qsizetype, qsizetype) override;
+    void itemsReset() override;
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    void setCollisions(const QList<qsizetype>&, Task::Resolution);
+    void setPreview(qsizetype, const QStringList&);
+    void setTask(Task*);
+
+private:
+    Task* task;
+    qsizetype rows;
+    QList<QString> preview;
+    bool previewing;
+    QBitArray collisions;
+    qsizetype collisionCount;
+    Task::Resolution resolution;
+    void clearCollisions();
+    bool showsCollisions() const;
+    void updateColumn(int);
+    void updateRows(qsizetype, qsizetype);
+};
+
+#endif // TASKMODEL_H
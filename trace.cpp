@@ -0,0 +1,177 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <QMutex>
+#include <QtDebug>
+#include "trace.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    struct Event
+    {
+        const char* name;
+        qint64 begin;
+        qint64 end;
+        int thread;
+    };
+
+    struct State
+    {
+        QMutex mutex;
+        QElapsedTimer clock;
+        QString path;
+        QFile file;
+        QList<Event> events;
+        QAtomicInteger<qint64> counts[Trace::CounterCount];
+        QAtomicInt threads;
+        qint64 runBegin = 0;
+    };
+
+    State& state()
+    {
+        static State instance;
+        return instance;
+    }
+
+    const char* const counterNames[Trace::CounterCount] = {"files", "bytesConverted", "syscalls", "failures"};
+
+    // Chrome groups events by thread; numbering threads as they first
+    // record something keeps the ids small and stable within a run.
+    int threadNumber()
+    {
+        thread_local int number = state().threads.fetchAndAddRelaxed(1) + 1;
+        return number;
+    }
+}
+
+QAtomicInt Trace::enabled(0);
+
+static const bool startedFromEnvironment = []() {
+    QString path = qEnvironmentVariable("KOI_RENAMER_TRACE");
+    if (!path.isEmpty())
+        Trace::start(path);
+    return !path.isEmpty();
+}();
+
+qint64 Trace::peakMemory()
+{
+#if defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(Q_OS_MACOS)
+    return usage.ru_maxrss;
+#else
+    return qint64(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+void Trace::start(const QString& path)
+{
+    State& s = state();
+    {
+        QMutexLocker locker(&s.mutex);
+        if (!s.clock.isValid())
+            s.clock.start();
+        if (s.path != path)
+            s.file.close();
+        s.path = path;
+        s.runBegin = s.clock.nsecsElapsed() / 1000;
+    }
+    Trace::enabled.storeRelaxed(1);
+}
+
+void Trace::summarize(const char* run)
+{
+    if (!Trace::isEnabled())
+        return;
+    State& s = state();
+    qint64 counts[Trace::CounterCount];
+    for (int c = 0; c < Trace::CounterCount; ++c)
+        counts[c] = s.counts[c].fetchAndStoreRelaxed(0);
+    qint64 peak = Trace::peakMemory();
+    QMutexLocker locker(&s.mutex);
+    qint64 end = Trace::now();
+    QString line = QString("trace: %1 %2 ms").arg(run).arg((end - s.runBegin) / 1000.0, 0, 'f', 1);
+    QJsonObject args;
+    for (int c = 0; c < Trace::CounterCount; ++c)
+    {
+        line += QString(", %1 %2").arg(counterNames[c]).arg(counts[c]);
+        args.insert(counterNames[c], double(counts[c]));
+    }
+    line += QString(", peak %1 MiB").arg(peak / 1048576.0, 0, 'f', 1);
+    args.insert("peakMemory", double(peak));
+    qInfo().noquote() << line;
+    QJsonObject counter;
+    counter.insert("name", run);
+    counter.insert("ph", "C");
+    counter.insert("ts", double(end));
+    counter.insert("pid", double(QCoreApplication::applicationPid()));
+    counter.insert("args", args);
+    QJsonArray events;
+    events.append(counter);
+    s.events.append(Event{run, s.runBegin, end, 0});
+    s.runBegin = end;
+    foreach (const auto& event, s.events)
+    {
+        QJsonObject object;
+        object.insert("name", event.name);
+        object.insert("ph", "X");
+        object.insert("ts", double(event.begin));
+        object.insert("dur", double(event.end - event.begin));
+        object.insert("pid", double(QCoreApplication::applicationPid()));
+        object.insert("tid", event.thread);
+        events.append(object);
+    }
+    s.events.clear();
+    // Each run appends its own events in the array form of the format,
+    // whose closing bracket may be left out, so the file can be read
+    // whenever the process ends and is never rewritten.
+    QByteArray json = QJsonDocument(events).toJson(QJsonDocument::Compact);
+    json = json.mid(1, json.size() - 2);
+    if (!s.file.isOpen())
+    {
+        s.file.setFileName(s.path);
+        if (!s.file.open(QIODevice::WriteOnly | QIODevice::Truncate) || s.file.write("[") < 0)
+        {
+            qWarning() << "Cannot write trace " << s.path << ": " << s.file.errorString();
+            s.file.close();
+            return;
+        }
+    }
+    else
+    {
+        json.prepend(",\n");
+    }
+    if (s.file.write(json) < 0 || !s.file.flush())
+        qWarning() << "Cannot write trace " << s.path << ": " << s.file.errorString();
+}
+
+void Trace::count(Counter counter, qint64 n)
+{
+    state().counts[counter].fetchAndAddRelaxed(n);
+}
+
+qint64 Trace::now()
+{
+    return state().clock.nsecsElapsed() / 1000;
+}
+
+void Trace::record(const char* name, qint64 begin)
+{
+    qint64 end = Trace::now();
+    int thread = threadNumber();
+    State& s = state();
+    QMutexLocker locker(&s.mutex);
+    s.events.append(Event{name, begin, end, thread});
+}
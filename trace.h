@@ -0,0 +1,42 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QAtomicInt>
+#include <QString>
+
+// Hot-path instrumentation: timed spans, per-run counters and the peak
+// resident set, written as Chrome trace-event JSON (chrome://tracing,
+// Perfetto). It is off unless KOI_RENAMER_TRACE names the output file or
+// start() is called; when off, a span or a counter costs one relaxed load.
+// Span and run names must be string literals. Every summarize() ends a
+// run: it prints one summary line, appends the run's events to the trace
+// file, and drops them and zeroes the counters.
+class Trace
+{
+public:
+    enum Counter {Files, BytesConverted, Syscalls, Failures, CounterCount};
+    class Span
+    {
+    public:
+        explicit Span(const char* name) : name(Trace::isEnabled() ? name : nullptr), begin(this->name ? Trace::now() : 0) {}
+        ~Span() { if (this->name) Trace::record(this->name, this->begin); }
+
+    private:
+        Q_DISABLE_COPY(Span)
+        const char* name;
+        qint64 begin;
+    };
+    static void add(Counter counter, qint64 n = 1) { if (Trace::isEnabled()) Trace::count(counter, n); }
+    static bool isEnabled() { return Trace::enabled.loadRelaxed(); }
+    static qint64 peakMemory();
+    static void start(const QString&);
+    static void summarize(const char*);
+
+private:
+    static QAtomicInt enabled;
+    static void count(Counter, qint64);
+    static qint64 now();
+    static void record(const char*, qint64);
+};
+
+#endif // TRACE_H
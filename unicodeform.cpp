@@ -0,0 +1,199 @@
+#include "unicodeform.h"
+
+#if defined(Q_PROCESSOR_X86) && (defined(Q_CC_GNU) || defined(Q_CC_CLANG))
+#define UNICODEFORM_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Half-open ranges of code units, as their first unit and their size. A
+// surrogate is never inside one, so a name outside the BMP always takes
+// the full conversion.
+struct Ranges
+{
+    int count;
+    char16_t low[5];
+    char16_t size[5];
+};
+
+// Indexed by QString::NormalizationForm. Below U+00C0 nothing decomposes,
+// and below U+00A0 nothing has a compatibility mapping either; nothing
+// below U+0300, where the combining marks start, changes under NFC.
+// Unified ideographs have no decomposition at all, and kana without a
+// voicing mark are composed forms that only decompose as themselves.
+constexpr Ranges formRanges[] = {
+    {3, {0x0000, 0x3400, 0x4e00}, {0x00c0, 0x19c0, 0x5200}},
+    {5, {0x0000, 0x3041, 0x30a1, 0x3400, 0x4e00}, {0x0300, 0x0056, 0x005a, 0x19c0, 0x5200}},
+    {3, {0x0000, 0x3400, 0x4e00}, {0x00a0, 0x19c0, 0x5200}},
+    {5, {0x0000, 0x3041, 0x30a1, 0x3400, 0x4e00}, {0x00a0, 0x0056, 0x005a, 0x19c0, 0x5200}},
+};
+
+constexpr Ranges asciiRanges = {1, {0x0000}, {0x0080}};
+
+typedef bool (*Kernel)(const char16_t*, qsizetype, const Ranges&);
+
+bool isInsideScalar(const char16_t* s, qsizetype size, const Ranges& ranges)
+{
+    for (qsizetype i = 0; i < size; ++i)
+    {
+        bool inside = false;
+        for (int r = 0; r < ranges.count && !inside; ++r)
+            inside = char16_t(s[i] - ranges.low[r]) < ranges.size[r];
+        if (!inside)
+            return false;
+    }
+    return true;
+}
+
+#ifdef UNICODEFORM_X86
+// There is no unsigned 16-bit compare before AVX-512, but a unit is in a
+// range exactly when its offset from the start, saturated down by the
+// size less one, comes out zero.
+
+__attribute__((target("sse2"))) bool isInsideSse2(const char16_t* s, qsizetype size, const Ranges& ranges)
+{
+    const __m128i zero = _mm_setzero_si128();
+    qsizetype i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        __m128i units = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i inside = zero;
+        for (int r = 0; r < ranges.count; ++r)
+        {
+            __m128i offset = _mm_sub_epi16(units, _mm_set1_epi16(short(ranges.low[r])));
+            __m128i beyond = _mm_subs_epu16(offset, _mm_set1_epi16(short(ranges.size[r] - 1)));
+            inside = _mm_or_si128(inside, _mm_cmpeq_epi16(beyond, zero));
+        }
+        if (_mm_movemask_epi8(inside) != 0xffff)
+            return false;
+    }
+    return isInsideScalar(s + i, size - i, ranges);
+}
+
+__attribute__((target("avx2"))) bool isInsideAvx2(const char16_t* s, qsizetype size, const Ranges& ranges)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    qsizetype i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m256i units = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        __m256i inside = zero;
+        for (int r = 0; r < ranges.count; ++r)
+        {
+            __m256i offset = _mm256_sub_epi16(units, _mm256_set1_epi16(short(ranges.low[r])));
+            __m256i beyond = _mm256_subs_epu16(offset, _mm256_set1_epi16(short(ranges.size[r] - 1)));
+            inside = _mm256_or_si256(inside, _mm256_cmpeq_epi16(beyond, zero));
+        }
+        if (quint32(_mm256_movemask_epi8(inside)) != 0xffffffff)
+            return false;
+    }
+    return isInsideSse2(s + i, size - i, ranges);
+}
+#endif
+
+Kernel resolveKernel()
+{
+#ifdef UNICODEFORM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return isInsideAvx2;
+    if (__builtin_cpu_supports("sse2"))
+        return isInsideSse2;
+#endif
+    return isInsideScalar;
+}
+
+bool isInside(QStringView text, const Ranges& ranges)
+{
+    static const Kernel kernel = resolveKernel();
+    return kernel(text.utf16(), text.size(), ranges);
+}
+
+}
+
+void UnicodeForm::changeCase(QString& text, Case letterCase)
+{
+    if (isInside(text, asciiRanges))
+    {
+        UnicodeForm::changeAsciiCase(text, letterCase);
+        return;
+    }
+    switch (letterCase)
+    {
+        case UnicodeForm::UpperCase:
+            text = text.toUpper();
+        break;
+        case UnicodeForm::LowerCase:
+            text = text.toLower();
+        break;
+        case UnicodeForm::TitleCase:
+            UnicodeForm::titleCase(text);
+        break;
+    }
+}
+
+bool UnicodeForm::isUntouched(QStringView text, QString::NormalizationForm form)
+{
+    return isInside(text, formRanges[form]);
+}
+
+void UnicodeForm::normalize(QString& text, QString::NormalizationForm form)
+{
+    if (!UnicodeForm::isUntouched(text, form))
+        text = text.normalized(form);
+}
+
+void UnicodeForm::changeAsciiCase(QString& text, Case letterCase)
+{
+    // The same mapping QString and titleCase() give ASCII, without the
+    // copy: a word starts after anything that is not a letter or a digit.
+    char16_t* data = reinterpret_cast<char16_t*>(text.data());
+    qsizetype size = text.size();
+    switch (letterCase)
+    {
+        case UnicodeForm::UpperCase:
+            for (qsizetype i = 0; i < size; ++i)
+                data[i] -= data[i] >= u'a' && data[i] <= u'z' ? 0x20 : 0;
+        break;
+        case UnicodeForm::LowerCase:
+            for (qsizetype i = 0; i < size; ++i)
+                data[i] += data[i] >= u'A' && data[i] <= u'Z' ? 0x20 : 0;
+        break;
+        case UnicodeForm::TitleCase:
+        {
+            bool wordStart = true;
+            for (qsizetype i = 0; i < size; ++i)
+            {
+                char16_t c = data[i];
+                bool lower = c >= u'a' && c <= u'z';
+                bool upper = c >= u'A' && c <= u'Z';
+                if (wordStart && lower)
+                    data[i] = c - 0x20;
+                else if (!wordStart && upper)
+                    data[i] = c + 0x20;
+                wordStart = !lower && !upper && !(c >= u'0' && c <= u'9');
+            }
+        }
+        break;
+    }
+}
+
+void UnicodeForm::titleCase(QString& text)
+{
+    // Code point by code point: the first letter of a word in title case,
+    // the rest in lower case, a word being a run of letters, digits and
+    // the marks on them.
+    QString result;
+    result.reserve(text.size());
+    bool wordStart = true;
+    for (qsizetype i = 0; i < text.size(); ++i)
+    {
+        char32_t c = text.at(i).unicode();
+        if (QChar::isHighSurrogate(c) && i + 1 < text.size() && text.at(i + 1).isLowSurrogate())
+            c = QChar::surrogateToUcs4(char16_t(c), text.at(++i).unicode());
+        result += QChar::fromUcs4(wordStart ? QChar::toTitleCase(c) : QChar::toLower(c));
+        wordStart = !QChar::isLetterOrNumber(c) && !QChar::isMark(c);
+    }
+    text = result;
+}
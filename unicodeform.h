@@ -0,0 +1,28 @@
+#ifndef UNICODEFORM_H
+#define UNICODEFORM_H
+
+#include <QString>
+
+// Unicode normalization and case mapping of names, with a fast path for
+// the names that do not need the full conversion, which is most of them.
+// A name whose code units all lie in ranges a form leaves untouched (ASCII
+// and the Latin-1 letters, unified CJK ideographs, kana for the composed
+// forms) is already in that form, so it is left as it is; a pure ASCII
+// name has its case mapped in place. Only the remaining names go through
+// QString::normalized(), toUpper() or toLower(), so the result is always
+// that of the full conversion. The scan uses SSE2 or AVX2 when the CPU
+// has them.
+class UnicodeForm
+{
+public:
+    enum Case {UpperCase, LowerCase, TitleCase};
+    static void changeCase(QString&, Case);
+    static bool isUntouched(QStringView, QString::NormalizationForm);
+    static void normalize(QString&, QString::NormalizationForm);
+
+private:
+    static void changeAsciiCase(QString&, Case);
+    static void titleCase(QString&);
+};
+
+#endif // UNICODEFORM_H